@@ -0,0 +1,222 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+// Benchmarks the PIO readers on a synthetic dump (or an existing one
+// given with -f).  Each benchmark is repeated and the best and median
+// times are reported.  The dump is usually in the page cache, so the
+// read numbers are memory rather than disk bandwidth unless the cache
+// is dropped first.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pioInterface.hpp"
+#include "pioSynthetic.hpp"
+#include "pioUring.hpp"
+
+static void usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  -f file    benchmark an existing dump instead of a synthetic one\n"
+         "  -o file    synthetic dump to write [pioBench-dmp000000]\n"
+         "  -c cells   number of cells [1048576]\n"
+         "  -d dims    number of dimensions [3]\n"
+         "  -l levels  number of AMR levels [4]\n"
+         "  -m mats    number of materials [4]\n"
+         "  -k mats    at most this many materials per cell [2]\n"
+         "  -a arrays  extra cell arrays [8]\n"
+         "  -s arrays  extra one-value arrays, to grow the index [0]\n"
+         "  -r count   repetitions of each benchmark [3]\n"
+         "  -t threads threads, 0 for all hardware threads [0]\n"
+         "  -q depth   io_uring queue depth [32]\n"
+         "  -p prefix  write statistics of one instrumented pass to\n"
+         "             <prefix>.json and a Chrome trace to <prefix>.trace\n"
+         "  -x         remove the synthetic dump when done\n",
+         name);
+}
+
+/** Runs f repeat times, each after an untimed call to setup, and
+ *  prints best and median time and the rate for the best time.
+ **/
+static void bench(const char *name, int repeat, double amount,
+                  const char *unit, std::function<void()> f,
+                  std::function<void()> setup = nullptr) {
+  std::vector<double> t;
+  for (int r = 0; r < repeat; r++) {
+    if (setup)
+      setup();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    t.push_back(dt.count());
+  }
+  std::sort(t.begin(), t.end());
+  printf("%-24s %10.4f %10.4f %12.1f %s\n", name, t[0], t[t.size() / 2],
+         amount / t[0], unit);
+}
+
+int main(int argc, char **argv) {
+  PioSyntheticConfig config;
+  std::string file, out = "pioBench-dmp000000", statsPrefix;
+  int repeat = 3, nThreads = 0, depth = 32;
+  bool remove = false;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "-x") {
+      remove = true;
+      continue;
+    }
+    if (a.size() != 2 || a[0] != '-' || i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (a[1]) {
+    case 'f': file = v; break;
+    case 'o': out = v; break;
+    case 'c': config.nCell = atoll(v); break;
+    case 'd': config.nDim = atoi(v); break;
+    case 'l': config.nLevel = atoi(v); break;
+    case 'm': config.nMat = atoi(v); break;
+    case 'k': config.matsPerCell = atoi(v); break;
+    case 'a': config.nCellArrays = atoi(v); break;
+    case 's': config.nSmallArrays = atoi(v); break;
+    case 'r': repeat = std::max(1, atoi(v)); break;
+    case 't': nThreads = atoi(v); break;
+    case 'q': depth = atoi(v); break;
+    case 'p': statsPrefix = v; break;
+    default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (file.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    PioSynthetic synthetic(config);
+    if (!synthetic.write(out, true))
+      return 1;
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    printf("generated in %.2f s\n", dt.count());
+    file = out;
+  }
+
+  PIO probe(file);
+  const int64_t nCell = probe.numcell();
+  const double nArrays = probe.arrayOrder.size();
+  std::vector<std::string> cellArrays;
+  double cellBytes = 0.0;
+  for (auto &name : probe.arrayOrder) {
+    auto it = probe.arrays.find(name);
+    if (it != probe.arrays.end() && it->second.length == nCell) {
+      cellArrays.push_back(name);
+      cellBytes += 8.0 * nCell;
+    }
+  }
+  printf("%s: %ld cells, %.0f arrays, %zu cell arrays\n\n", file.c_str(),
+         long(nCell), nArrays, cellArrays.size());
+  printf("%-24s %10s %10s %12s\n", "benchmark", "best[s]", "median[s]",
+         "rate");
+
+  bench("open", repeat, nArrays, "arrays/s", [&]() { PIO p(file); });
+  bench("readArray", repeat, cellBytes / 1e6, "MB/s", [&]() {
+    PIO p(file);
+    for (auto &name : cellArrays)
+      p.readArray(name);
+  });
+  bench("readArrays (parallel)", repeat, cellBytes / 1e6, "MB/s", [&]() {
+    PIO p(file);
+    p.readArrays(cellArrays, nThreads);
+  });
+  bench("readArrays (io_uring)", repeat, cellBytes / 1e6, "MB/s", [&]() {
+    PIO p(file);
+    PIOUringReader reader(p, depth);
+    reader.readArrays(cellArrays);
+  });
+
+  bench("readArray (drop-behind)", repeat, cellBytes / 1e6, "MB/s", [&]() {
+    PIO p(file);
+    p.setStreamMode(PIO::dropBehind);
+    for (auto &name : cellArrays)
+      p.readArray(name);
+  });
+  bench("readArray (direct)", repeat, cellBytes / 1e6, "MB/s", [&]() {
+    PIO p(file);
+    p.setStreamMode(PIO::direct);
+    for (auto &name : cellArrays)
+      p.readArray(name);
+  });
+
+  // about 1% of the cells, each read on its own (no merging) as in
+  // queries that pull scattered cells
+  std::vector<int64_t> scattered;
+  for (int64_t i = 0; i < nCell; i++) {
+    if ((uint64_t(i) * 2654435761ull) % 100 == 0)
+      scattered.push_back(i);
+  }
+  const std::string gathered = cellArrays.empty() ? "" : cellArrays[0];
+  bench("readArrayGather 1%", repeat, scattered.size() / 1e6, "Mcell/s",
+        [&]() { probe.readArrayGather(gathered, scattered, 0); });
+  {
+    PIOUringReader reader(probe, depth);
+    bench(reader.available() ? "gather 1% (io_uring)" : "gather 1% (no uring)",
+          repeat, scattered.size() / 1e6, "Mcell/s",
+          [&]() { reader.readArrayGather(gathered, scattered, 0); });
+  }
+  bench("PioInterface + mesh", repeat, nCell / 1e6, "Mcell/s", [&]() {
+    PioInterface pi(file.c_str(), 0, 0, nThreads);
+    pi.loadMesh();
+  });
+
+  PioInterface pi(file.c_str(), 0, 0, nThreads);
+  pi.loadMesh();
+  double csrLength = pi.matIds().size();
+  bench("getMaterialVariable", repeat, csrLength / 1e6, "Mentry/s",
+        [&]() { pi.getMaterialVariable("chunk_vol"); });
+  std::unique_ptr<PioInterface> fresh;
+  bench(
+      "updateUniqMap", repeat, nCell / 1e6, "Mcell/s",
+      [&]() { fresh->uniqMap(); },
+      [&]() {
+        fresh.reset(new PioInterface(file.c_str(), 1, 0, nThreads));
+        fresh->center();
+        fresh->level();
+        fresh->dXyz();
+      });
+
+  if (!statsPrefix.empty()) {
+    PIOStats stats;
+    {
+      PioInterface p(file.c_str(), 1, 0, nThreads, &stats);
+      p.loadMesh();
+      p.getMaterialVariable("chunk_vol");
+    }
+    printf("\nread %.1f MB in %lu reads (%lu seeks), wrote %s.json\n",
+           stats.bytesRead() / 1e6, (unsigned long)stats.reads(),
+           (unsigned long)stats.seeks(), statsPrefix.c_str());
+    if (!stats.writeJson(statsPrefix + ".json") ||
+        !stats.writeChromeTrace(statsPrefix + ".trace"))
+      return 1;
+  }
+
+  if (remove && file == out)
+    unlink(out.c_str());
+  return 0;
+}
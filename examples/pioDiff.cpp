@@ -0,0 +1,89 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+// Compares two dumps cell by cell through the unique cell ids, for
+// instance from runs on different numbers of processors.  Exits with
+// 0 if they agree within the tolerances, 1 if they do not and 2 on
+// bad arguments.
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "pioDiff.hpp"
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] dump1 dump2\n"
+         "  -a tol     absolute tolerance [0]\n"
+         "  -r tol     relative tolerance [0]\n"
+         "  -u ulps    tolerance in units of the last place [0]\n"
+         "  -n count   offending cells reported per array [10]\n"
+         "  -v names   comma separated arrays to compare [all]\n"
+         "  -t threads threads, 0 for all hardware threads [0]\n"
+         "  -i         match cells by index instead of unique id\n",
+         name);
+}
+
+int main(int argc, char **argv) {
+  PioDiffOptions options;
+  int uniq = 1;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "-i") {
+      uniq = 0;
+      continue;
+    }
+    if (a[0] != '-') {
+      files.push_back(a);
+      continue;
+    }
+    if (a.size() != 2 || i + 1 >= argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    const char *v = argv[++i];
+    switch (a[1]) {
+    case 'a': options.absTol = atof(v); break;
+    case 'r': options.relTol = atof(v); break;
+    case 'u': options.ulpTol = strtoull(v, nullptr, 10); break;
+    case 'n': options.maxReport = atoi(v); break;
+    case 't': options.nThreads = atoi(v); break;
+    case 'v': {
+      std::istringstream s(v);
+      std::string name;
+      while (std::getline(s, name, ','))
+        options.arrays.push_back(name);
+      break;
+    }
+    default: usage(argv[0]); return 2;
+    }
+  }
+  if (files.size() != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  PioInterface a(files[0].c_str(), uniq, 0, options.nThreads);
+  PioInterface b(files[1].c_str(), uniq, 0, options.nThreads);
+  PioDiff diff(a, b, options);
+  std::vector<PioArrayDiff> result = diff.run();
+  PioDiff::print(stdout, result);
+  if (!PioDiff::same(result))
+    return 1;
+  printf("%zu arrays agree\n", result.size());
+  return 0;
+}
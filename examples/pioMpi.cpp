@@ -0,0 +1,123 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+// Reads a dump partitioned over MPI ranks and prints the global
+// statistics of some cell and material arrays, e.g.
+//
+//   mpirun -np 4 ./pioMpi -c run-dmp000100 pres_0 chunk_vol_0
+//
+// With -v rank 0 also reads every array whole and checks that the
+// gathered partitions match it.  Exits with 1 if they do not.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pioMpi.hpp"
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+  PioPartition::Scheme scheme = PioPartition::contiguous;
+  bool verify = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-c"))
+      scheme = PioPartition::curve;
+    else if (!strcmp(argv[i], "-v"))
+      verify = true;
+    else
+      args.push_back(argv[i]);
+  }
+  if (args.size() < 2) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0)
+      printf("Usage: mpirun -np N %s [-c] [-v] dump array...\n"
+             "  -c  partition along a space-filling curve\n"
+             "  -v  check the partitions against whole reads\n",
+             argv[0]);
+    MPI_Finalize();
+    return 2;
+  }
+
+  PioPartition part(args[0], MPI_COMM_WORLD, scheme);
+  if (part.failed()) {
+    MPI_Finalize();
+    return 1;
+  }
+  const int64_t nMin = part.allReduce(part.nLocal(), MPI_MIN);
+  const int64_t nMax = part.allReduce(part.nLocal(), MPI_MAX);
+  if (part.rank() == 0)
+    printf("%ld cells on %d ranks, %ld to %ld per rank\n", long(part.nCell()),
+           part.size(), long(nMin), long(nMax));
+
+  int bad = 0;
+  for (size_t a = 1; a < args.size(); a++) {
+    const std::string &name = args[a];
+    const bool material = name.compare(0, 6, "chunk_") == 0 &&
+                          part.pio().arrays.count(name) &&
+                          part.pio().arrays.at(name).length != part.nCell();
+    std::vector<double> x =
+        material ? part.readMaterial(name) : part.readCells(name);
+    const int64_t expected =
+        material ? part.matStartIndex().back() : part.nLocal();
+    if (part.allReduce(int(int64_t(x.size()) != expected), MPI_MAX)) {
+      bad = 1;
+      continue;
+    }
+    PioStatistics s;
+    for (double v : x)
+      s.add(v);
+    s = part.allReduce(s);
+    if (part.rank() == 0)
+      printf("%-24s count %ld min %.6e max %.6e mean %.6e\n", name.c_str(),
+             long(s.count), s.min, s.max, s.mean());
+    if (!verify)
+      continue;
+
+    std::vector<double> all;
+    if (material) {
+      // one value per owned cell: the sum over its materials
+      std::vector<double> sum(part.nLocal(), 0.0);
+      const std::vector<int64_t> &start = part.matStartIndex();
+      for (int64_t i = 0; i < part.nLocal(); i++)
+        for (int64_t k = start[i]; k < start[i + 1]; k++)
+          sum[i] += x[k];
+      all = part.gatherCells(sum);
+    } else {
+      all = part.gatherCells(x);
+    }
+    if (part.rank() != 0)
+      continue;
+    std::vector<double> whole = part.pio().readArray(name);
+    if (material) {
+      std::vector<double> nummat = part.pio().readArray("chunk_nummat_0");
+      std::vector<double> sum(part.nCell(), 0.0);
+      for (int64_t i = 0, k = 0; i < part.nCell(); i++)
+        for (int64_t j = 0; j < int64_t(nummat[i]); j++)
+          sum[i] += whole[k++];
+      whole.swap(sum);
+    }
+    const bool same = all.size() == whole.size() &&
+                      !memcmp(all.data(), whole.data(),
+                              all.size() * sizeof(double));
+    printf("%-24s %s\n", name.c_str(), same ? "matches" : "DIFFERS");
+    bad |= !same;
+  }
+  MPI_Bcast(&bad, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Finalize();
+  return bad;
+}
@@ -13,13 +13,33 @@
 // so.
 //========================================================================================
 
+#ifndef PIO_HPP_
+#define PIO_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pioBufferPool.hpp"
+#include "pioStats.hpp"
+
 #pragma pack(push, 1)
 struct PIOHeader {
   char filetype[8];
@@ -47,16 +67,94 @@ struct arrayDimensions {
   arrayDimensions() : l(0), w(0) {}
 };
 
+/** Runs f(i) for every i in [0, n) on up to nThreads threads (0 uses
+ *  all hardware threads).  Work is handed out one index at a time, so
+ *  callers should make each index a reasonably large piece of work.
+ **/
+template <typename F> void pioParallelFor(int64_t n, int nThreads, F f) {
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  nThreads = static_cast<int>(std::min<int64_t>(nThreads, n));
+  if (nThreads <= 1) {
+    for (int64_t i = 0; i < n; i++)
+      f(i);
+    return;
+  }
+  std::atomic<int64_t> next(0);
+  auto worker = [&]() {
+    for (int64_t i = next++; i < n; i = next++)
+      f(i);
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < nThreads; t++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &t : threads)
+    t.join();
+}
+
+/** Read-only view of an array that lives inside a memory mapped PIO file.
+ *  The view is only valid for as long as the PIO object that handed it out.
+ **/
+class PIOArrayView {
+public:
+  PIOArrayView() : data_(nullptr), size_(0) {}
+  PIOArrayView(const double *data, size_t size) : data_(data), size_(size) {}
+  const double *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const double &operator[](size_t i) const { return data_[i]; }
+  const double *begin() const { return data_; }
+  const double *end() const { return data_ + size_; }
+
+private:
+  const double *data_;
+  size_t size_;
+};
+
+/** Parsed array index of a PIO file.  It is not modified once it has
+ *  been loaded, so PIO objects opened on dumps with the same layout
+ *  can share one copy.
+ **/
+struct PIOIndex {
+  std::vector<std::string> arrayOrder; //< array names in file order
+  std::unordered_map<std::string, PIOArrayHeader> arrays; //< name_index
+  std::unordered_map<std::string, arrayDimensions> arrayDims; //< base name
+  int ndim = 0;
+  int64_t numcell = 0;
+  uint64_t checksum = 0; //< identifies the layout, see PIO::indexChecksum()
+};
+
 class PIO {
+private:
+  std::shared_ptr<PIOIndex> index_; //< must precede the references below
+
 public:
-  std::vector<std::string> arrayOrder;
-  std::map<std::string, PIOArrayHeader> arrays;
-  std::map<std::string, arrayDimensions> arrayDims;
-  PIO(std::string filename, bool verbose = false) {
-    ndim_ = 0;
-    numcell_ = 0;
-    fp = fopen(filename.c_str(), "rb");
-    auto iRead = fread(&header_, sizeof(PIOHeader), 1, fp);
+  const std::vector<std::string> &arrayOrder;
+  const std::unordered_map<std::string, PIOArrayHeader> &arrays;
+  const std::unordered_map<std::string, arrayDimensions> &arrayDims;
+  /** Opens a dump.  If index is given (for instance the index of
+   *  another dump with the same layout, see PioCatalog) it is used
+   *  as is and the index of this file is never read.  If stats is
+   *  given, reads and timings are recorded in it (see PIOStats).
+   **/
+  PIO(std::string filename, bool verbose = false, bool useMmap = false,
+      std::shared_ptr<PIOIndex> index = nullptr, PIOStats *stats = nullptr)
+      : index_(index ? index : std::make_shared<PIOIndex>()),
+        arrayOrder(index_->arrayOrder), arrays(index_->arrays),
+        arrayDims(index_->arrayDims), stats_(stats) {
+    filename_ = filename;
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      std::cout << "Unable to open file " << filename << std::endl;
+      memset(&header_, -1, sizeof(PIOHeader));
+      return;
+    }
+    if (readBytes(0, sizeof(PIOHeader), &header_) != sizeof(PIOHeader)) {
+      std::cout << "Unable to read header" << std::endl;
+      memset(&header_, -1, sizeof(PIOHeader));
+      return;
+    }
     if (verbose) {
       printf("%8s\n", header_.filetype);
     }
@@ -82,12 +180,75 @@ public:
       std::cout << "File Signature: " << header_.signature << std::endl;
     }
     // Load array headers
-    loadArrayHeaders();
+    if (!index)
+      loadArrayHeaders();
+    if (useMmap) {
+      mapFile();
+    }
+  }
+  PIO(const PIO &) = delete;
+  PIO &operator=(const PIO &) = delete;
+  ~PIO() {
+    unmapFile();
+    if (directFd_ >= 0)
+      close(directFd_);
+    if (fd_ >= 0)
+      close(fd_);
   }
-  ~PIO() { fclose(fp); }
   PIOHeader header() { return header_; }
-  int ndim() { return ndim_; }
-  int numcell() { return numcell_; }
+  int ndim() { return index_->ndim; }
+  int numcell() { return index_->numcell; }
+  std::shared_ptr<const PIOIndex> index() { return index_; }
+  PIOStats *stats() { return stats_; }
+  int fd() { return fd_; } //< -1 if the file could not be opened
+
+  /** How array reads treat the page cache.  cached leaves it to the
+   *  kernel.  dropBehind asks for aggressive readahead and drops each
+   *  range from the cache once it has been read; direct reads with
+   *  O_DIRECT through aligned buffers, bypassing the cache.
+   **/
+  enum StreamMode { cached, dropBehind, direct };
+
+  /** Switches the mode of array reads, for one-pass tools (converters,
+   *  reducers) that stream a dump larger than memory and should not
+   *  evict the pages other jobs on the node are using:
+   *
+   *    PIO pio("run-dmp000100");
+   *    pio.setStreamMode(PIO::direct);
+   *    PIOBlockReader r(pio, {"pres_0"}, 1 << 22);
+   *
+   *  direct stages reads in buffers of pool (a new pool of 4 MB
+   *  buffers if none is given), which can be shared by several dumps.
+   *  If the file system does not support O_DIRECT, dropBehind is used
+   *  instead and false is returned.  dropBehind also evicts pages of
+   *  the dump that were cached before, so prefer direct for dumps
+   *  other jobs are reading.  Mapped files are always read through
+   *  the mapping.
+   **/
+  bool setStreamMode(StreamMode mode,
+                     std::shared_ptr<PIOBufferPool> pool = nullptr) {
+    if (fd_ < 0)
+      return false;
+    bool ok = true;
+    if (mode == direct && directFd_ < 0) {
+#ifdef O_DIRECT
+      directFd_ = open(filename_.c_str(), O_RDONLY | O_DIRECT);
+#endif
+      if (directFd_ < 0) {
+        mode = dropBehind;
+        ok = false;
+      }
+    }
+    if (mode == direct)
+      pool_ = pool ? pool : std::make_shared<PIOBufferPool>();
+    posix_fadvise(fd_, 0, 0,
+                  mode == dropBehind ? POSIX_FADV_SEQUENTIAL
+                                     : POSIX_FADV_NORMAL);
+    streamMode_ = mode;
+    return ok;
+  }
+  StreamMode streamMode() { return streamMode_; }
+  void setStats(PIOStats *stats) { stats_ = stats; } //< null disables
 
   std::vector<double> variableRead(std::string name, int index = 0) {
     return readArray(name + "_" + std::to_string(index));
@@ -99,75 +260,494 @@ public:
 
   template <typename T>
   std::vector<T> variable(std::string name, int index = 0) {
-    auto base = variableRead(name, index);
-    return std::vector<T>(base.begin(), base.end());
+    return readArrayAs<T>(name + "_" + std::to_string(index));
+  }
+
+  /** Reads a variable into a caller supplied buffer of at least
+   *  the length of the array; see readArrayInto().
+   **/
+  template <typename T>
+  size_t variableInto(std::string name, T *out, int index = 0) {
+    return readArrayInto<T>(name + "_" + std::to_string(index), out);
+  }
+
+  /** Reads an array and converts it to type T in a single pass **/
+  template <typename T> std::vector<T> readArrayAs(std::string name) {
+    std::vector<T> v;
+    auto it = arrays.find(name);
+    if (it == arrays.end())
+      return v;
+    v.resize(static_cast<size_t>(it->second.length));
+    readArrayInto<T>(name, v.data());
+    return v;
+  }
+
+  /** Reads an array into out, converting from the on-disk doubles
+   *  to T block by block so that no full-length double copy is ever
+   *  held.  Returns the number of elements written (0 if the array
+   *  does not exist).
+   **/
+  template <typename T> size_t readArrayInto(std::string name, T *out) {
+    auto it = arrays.find(name);
+    if (it == arrays.end())
+      return 0;
+    const auto h = it->second;
+    const size_t length = static_cast<size_t>(h.length);
+    PIOStats::Scope scope(stats_, "array", name);
+    scope.addBytes(length * sizeof(double));
+    if (mapped()) {
+      auto view = arrayView(name);
+      if (stats_)
+        stats_->countMapped(view.size() * sizeof(double));
+      convert(view.data(), out, view.size());
+      return view.size();
+    }
+    const int64_t position = static_cast<int64_t>(h.position);
+    if constexpr (std::is_same<T, double>::value) {
+      return readDoubles(position, length, out);
+    }
+    std::vector<double> buffer(std::min(length, readBlockSize_));
+    size_t done = 0;
+    while (done < length) {
+      size_t n = std::min(length - done, readBlockSize_);
+      size_t iRead = readDoubles(position + done, n, buffer.data());
+      convert(buffer.data(), out + done, iRead);
+      done += iRead;
+      if (iRead < n)
+        break;
+    }
+    return done;
   }
 
   std::vector<double> readArray(std::string name) {
     std::vector<double> v;
-    if (arrays.count(name) > 0) {
-      auto h = arrays[name];
-      seek(h.position);
+    auto it = arrays.find(name);
+    if (it != arrays.end()) {
+      const auto &h = it->second;
+      PIOStats::Scope scope(stats_, "array", name);
       v.resize(h.length);
-      auto iRead = fread(v.data(), h.length, sizeof(double), fp);
+      scope.addBytes(v.size() * sizeof(double));
+      readDoubles(static_cast<int64_t>(h.position), v.size(), v.data());
     }
     return v;
   }
-  void seekRaw(size_t offset) {
-    auto myOffset = static_cast<size_t>(offset);
-    fseek(fp, static_cast<long int>(offset), SEEK_SET);
+
+  /** Reads several arrays concurrently on nThreads threads (0 uses
+   *  all hardware threads).  All reads are positional so one PIO can
+   *  be shared by any number of threads.  Missing arrays come back
+   *  empty.
+   **/
+  std::map<std::string, std::vector<double>>
+  readArrays(const std::vector<std::string> &names, int nThreads = 0) {
+    std::map<std::string, std::vector<double>> result;
+    std::vector<std::vector<double> *> slots;
+    for (auto &n : names)
+      slots.push_back(&result[n]);
+    pioParallelFor(names.size(), nThreads,
+                   [&](int64_t i) { *slots[i] = readArray(names[i]); });
+    return result;
   }
-  void seek(double offset) { seekRaw(8.0 * offset); }
 
-private:
-  FILE *fp;
-  int ndim_;
-  int numcell_;
-  PIOHeader header_;
+  /** Reads count elements of an array starting at element start.
+   *  The range is clipped to the length of the array.
+   **/
+  std::vector<double> readArrayRange(std::string name, int64_t start,
+                                     int64_t count) {
+    std::vector<double> v;
+    auto it = arrays.find(name);
+    if (it == arrays.end() || start < 0)
+      return v;
+    const int64_t length = static_cast<int64_t>(it->second.length);
+    v.resize(std::max<int64_t>(0, std::min(count, length - start)));
+    readArrayRangeInto(name, start, v.size(), v.data());
+    return v;
+  }
 
-  std::string toString(char *inS, int l) {
-    int idx = l;
-    while (idx) {
-      idx--;
-      if (inS[idx] == ' ') {
-        inS[idx] = '\0';
-      } else {
+  /** Same as readArrayRange() but reads into a caller supplied buffer
+   *  of at least count elements.  Returns the number of elements read.
+   **/
+  int64_t readArrayRangeInto(const std::string &name, int64_t start,
+                             int64_t count, double *out) {
+    auto it = arrays.find(name);
+    if (it == arrays.end() || start < 0)
+      return 0;
+    const int64_t length = static_cast<int64_t>(it->second.length);
+    count = std::min(count, length - start);
+    if (count <= 0)
+      return 0;
+    PIOStats::Scope scope(stats_, "array", name);
+    scope.addBytes(count * sizeof(double));
+    return readDoubles(static_cast<int64_t>(it->second.position) + start,
+                       count, out);
+  }
+
+  /** Reads count elements start, start+stride, ... of an array.
+   *  Short strides are served by reading whole runs and picking out
+   *  the elements, long strides by one read per element.
+   **/
+  std::vector<double> readArrayStrided(std::string name, int64_t start,
+                                       int64_t count, int64_t stride,
+                                       int64_t maxGap = defaultMaxGap_) {
+    std::vector<double> v;
+    auto it = arrays.find(name);
+    if (it == arrays.end() || start < 0 || stride < 1 || count <= 0)
+      return v;
+    const int64_t length = static_cast<int64_t>(it->second.length);
+    count = std::min(count, (length - start + stride - 1) / stride);
+    if (count <= 0)
+      return v;
+    PIOStats::Scope scope(stats_, "array", name);
+    scope.addBytes(count * sizeof(double));
+    v.resize(count);
+    if (!gatherRuns(
+            it->second, count, [=](int64_t k) { return start + k * stride; },
+            v.data(), maxGap))
+      v.clear();
+    return v;
+  }
+
+  /** Reads the elements of an array at the given indices, which must
+   *  be sorted in ascending order.  Indices closer than maxGap
+   *  elements apart are merged into a single read.  Returns an empty
+   *  vector if the array does not exist, the indices are not sorted or
+   *  out of range, or a read fails.
+   **/
+  std::vector<double> readArrayGather(std::string name,
+                                      const std::vector<int64_t> &indices,
+                                      int64_t maxGap = defaultMaxGap_) {
+    std::vector<double> v;
+    auto it = arrays.find(name);
+    if (it == arrays.end() || indices.empty())
+      return v;
+    const int64_t length = static_cast<int64_t>(it->second.length);
+    if (indices.front() < 0 || indices.back() >= length ||
+        !std::is_sorted(indices.begin(), indices.end()))
+      return v;
+    PIOStats::Scope scope(stats_, "array", name);
+    scope.addBytes(indices.size() * sizeof(double));
+    v.resize(indices.size());
+    if (!gatherRuns(
+            it->second, indices.size(), [&](int64_t k) { return indices[k]; },
+            v.data(), maxGap))
+      v.clear();
+    return v;
+  }
+
+  /** Zero-copy access to a variable; see arrayView() **/
+  PIOArrayView variableView(std::string name, int index = 0) {
+    return arrayView(name + "_" + std::to_string(index));
+  }
+
+  /** Returns a read-only view of an array straight out of the mapped
+   *  file.  Maps the file on first use if it was not opened with
+   *  useMmap.  Returns an empty view if the array does not exist or
+   *  the file cannot be mapped.
+   **/
+  PIOArrayView arrayView(std::string name) {
+    auto it = arrays.find(name);
+    if (it == arrays.end())
+      return PIOArrayView();
+    if (!mapFile())
+      return PIOArrayView();
+    const auto &h = it->second;
+    size_t offset = 8 * static_cast<size_t>(h.position);
+    size_t length = static_cast<size_t>(h.length);
+    if (offset + length * sizeof(double) > mapLength_)
+      return PIOArrayView();
+    const char *m = static_cast<const char *>(map_.load());
+    return PIOArrayView(reinterpret_cast<const double *>(m + offset), length);
+  }
+
+  /** Maps the whole file read-only and shared so that several
+   *  processes on a node can share the page cache.  Safe to call from
+   *  several threads at once: the file is mapped once and map_ is only
+   *  published after mapLength_ is set.
+   **/
+  bool mapFile() {
+    if (map_.load(std::memory_order_acquire))
+      return true;
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    if (map_.load(std::memory_order_relaxed))
+      return true;
+    if (fd_ < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size == 0)
+      return false;
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (m == MAP_FAILED)
+      return false;
+    mapLength_ = st.st_size;
+    map_.store(m, std::memory_order_release);
+    return true;
+  }
+  /** Unmaps the file; views handed out become invalid, so this must
+   *  not race with reads in other threads.
+   **/
+  void unmapFile() {
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    void *m = map_.exchange(nullptr);
+    if (m)
+      munmap(m, mapLength_);
+    mapLength_ = 0;
+  }
+  bool mapped() { return map_.load(std::memory_order_acquire) != nullptr; }
+
+
+  /** Positional read of n bytes at byte offset; safe to call from
+   *  several threads at once.  Returns the number of bytes read.
+   **/
+  size_t readBytes(size_t offset, size_t n, void *out) {
+    if (!stats_)
+      return preadFull(fd_, offset, n, out);
+    size_t r = preadFull(fd_, offset, n, out);
+    stats_->countRead(r, lastReadEnd_.exchange(offset + n) != offset);
+    return r;
+  }
+
+  /** pread()s until n bytes are read, end of file or an error **/
+  static size_t preadFull(int fd, size_t offset, size_t n, void *out) {
+    char *p = static_cast<char *>(out);
+    size_t done = 0;
+    while (done < n) {
+      ssize_t r = pread(fd, p + done, n - done, offset + done);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
         break;
-      }
+      done += r;
     }
-    char *s = strndup(inS, idx + 1);
-    std::string ret(s);
-    free(s);
-    return ret;
+    return done;
   }
-  void loadArrayHeaders() {
-    double pos = header_.position;
-    for (int i = 0; i < header_.nArrays; i++) {
-      seek(pos);
+
+  /** Reads the raw index block described by header h with one read **/
+  static std::vector<char> readIndexBlock(int fd, const PIOHeader &h) {
+    std::vector<char> block(static_cast<size_t>(h.nArrays) * 8 *
+                            static_cast<size_t>(h.lengthIndex));
+    block.resize(preadFull(fd, 8 * static_cast<size_t>(h.position),
+                           block.size(), block.data()));
+    return block;
+  }
+
+  /** FNV-1a hash of the index block and the header fields needed to
+   *  parse it.  Dumps with equal checksums have the same layout.
+   **/
+  static uint64_t indexChecksum(const PIOHeader &h,
+                                const std::vector<char> &block) {
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *p, size_t n) {
+      const unsigned char *c = static_cast<const unsigned char *>(p);
+      for (size_t i = 0; i < n; i++)
+        hash = (hash ^ c[i]) * 1099511628211ull;
+    };
+    add(&h.lengthName, sizeof(double));
+    add(&h.lengthIndex, sizeof(double));
+    add(&h.nArrays, sizeof(double));
+    add(block.data(), block.size());
+    return hash;
+  }
+
+  /** Parses a raw index block into idx **/
+  static void parseIndex(const PIOHeader &h, const std::vector<char> &block,
+                         PIOIndex &idx) {
+    const size_t lName = static_cast<size_t>(h.lengthName);
+    const size_t lEntry = 8 * static_cast<size_t>(h.lengthIndex);
+    if (lEntry < lName + sizeof(PIOArrayHeader))
+      return;
+    const size_t nEntries = block.size() / lEntry;
+
+    idx.arrayOrder.reserve(nEntries);
+    idx.arrays.reserve(nEntries);
+    idx.arrayDims.reserve(nEntries);
+    std::string baseName;
+    for (size_t i = 0; i < nEntries; i++) {
+      const char *entry = block.data() + i * lEntry;
       PIOArrayHeader a;
-      char name[static_cast<int>(header_.lengthName)];
-      size_t iRead;
-      iRead = fread(name, sizeof(char), header_.lengthName, fp);
-      iRead += fread(&a, sizeof(PIOArrayHeader), 1, fp);
-      auto baseName = toString(name, header_.lengthName);
-      auto nameStr = baseName + "_" + std::to_string(int(a.index));
-      arrayOrder.push_back(nameStr);
-      arrays[nameStr] = a;
-      if (!strncmp("cell_center", baseName.c_str(), 11)) {
-        numcell_ = a.length;
-        ndim_ = (ndim_ > a.index ? ndim_ : a.index);
+      memcpy(&a, entry + lName, sizeof(PIOArrayHeader));
+
+      // names are padded with blanks (or nulls) to lName characters
+      size_t l = strnlen(entry, lName);
+      while (l && entry[l - 1] == ' ')
+        l--;
+      baseName.assign(entry, l);
+      addIndexEntry(baseName, a, idx);
+    }
+    idx.checksum = indexChecksum(h, block);
+  }
+
+  /** Appends the array baseName_<a.index> to idx, as it would be found
+   *  next in an index block
+   **/
+  static void addIndexEntry(const std::string &baseName,
+                            const PIOArrayHeader &a, PIOIndex &idx) {
+    std::string nameStr;
+    nameStr.reserve(baseName.size() + 12);
+    nameStr.append(baseName).append("_").append(
+        std::to_string(static_cast<int>(a.index)));
+
+    if (!strncmp("cell_center", baseName.c_str(), 11)) {
+      idx.numcell = a.length;
+      idx.ndim = std::max(idx.ndim, static_cast<int>(a.index));
+    }
+
+    // Set dimensions of array
+    // default constructor gives zeros for first time
+    auto &x = idx.arrayDims[baseName];
+    x.l = a.length;
+    x.w++;
+
+    idx.arrays[nameStr] = a;
+    idx.arrayOrder.push_back(std::move(nameStr));
+  }
+
+private:
+  static constexpr size_t readBlockSize_ = 1 << 16; //< doubles per block read
+
+  // Written as a plain loop over restrict pointers so the compiler
+  // emits packed double->int32/int64 conversions
+  template <typename T>
+  static void convertBlock(const double *__restrict in, T *__restrict out,
+                           size_t n) {
+    for (size_t i = 0; i < n; i++)
+      out[i] = static_cast<T>(in[i]);
+  }
+
+  /** convertBlock(), timed if stats are being collected **/
+  template <typename T> void convert(const double *in, T *out, size_t n) {
+    if (!stats_) {
+      convertBlock(in, out, n);
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    convertBlock(in, out, n);
+    stats_->addConvertTime(std::chrono::steady_clock::now() - start);
+  }
+
+  static constexpr int64_t defaultMaxGap_ = 512; //< gather merge distance
+  static constexpr int64_t maxRunLength_ = 1 << 20; //< doubles per gather run
+
+  /** Reads n doubles starting at position (counted in doubles) **/
+  size_t readDoubles(int64_t position, int64_t n, double *out) {
+    if (const void *m = map_.load(std::memory_order_acquire)) {
+      size_t offset = 8 * static_cast<size_t>(position);
+      if (offset + n * sizeof(double) > mapLength_)
+        return 0;
+      memcpy(out, static_cast<const char *>(m) + offset,
+             n * sizeof(double));
+      if (stats_)
+        stats_->countMapped(n * sizeof(double));
+      return n;
+    }
+    const size_t offset = 8 * static_cast<size_t>(position);
+    if (streamMode_ == direct)
+      return readDirect(offset, n * sizeof(double), out) / sizeof(double);
+    const size_t r = readBytes(offset, n * sizeof(double), out);
+    if (streamMode_ == dropBehind)
+      posix_fadvise(fd_, offset, r, POSIX_FADV_DONTNEED);
+    return r / sizeof(double);
+  }
+
+  /** Reads n bytes at offset with O_DIRECT, through buffers of the
+   *  pool aligned to its alignment.  Anything O_DIRECT refuses to read
+   *  is read with plain pread() instead.
+   **/
+  size_t readDirect(size_t offset, size_t n, void *out) {
+    char *dst = static_cast<char *>(out);
+    const size_t a = pool_->alignment(), cap = pool_->bufferBytes();
+    size_t done = 0;
+    PIOBufferPool::Buffer buffer = pool_->acquire();
+    while (buffer && done < n) {
+      const size_t pos = offset + done;
+      const size_t lo = pos / a * a;
+      const size_t want = std::min(n - done, cap - (pos - lo));
+      const size_t length = (pos - lo + want + a - 1) / a * a;
+      const size_t r = preadFull(directFd_, lo, length, buffer.get());
+      if (r <= pos - lo)
+        break;
+      const size_t got = std::min(want, r - (pos - lo));
+      memcpy(dst + done, buffer.get() + (pos - lo), got);
+      done += got;
+      if (got < want)
+        break;
+    }
+    if (done < n)
+      done += preadFull(fd_, offset + done, n - done, dst + done);
+    if (stats_)
+      stats_->countRead(done, lastReadEnd_.exchange(offset + n) != offset);
+    return done;
+  }
+
+  /** Reads count elements whose (non-decreasing) indices are given by
+   *  index(k), merging indices less than maxGap apart into runs of at
+   *  most maxRunLength_ elements that are read with a single call.
+   *  Returns false if a read comes up short.
+   **/
+  template <typename F>
+  bool gatherRuns(const PIOArrayHeader &h, int64_t count, F index,
+                  double *out, int64_t maxGap) {
+    const int64_t base = static_cast<int64_t>(h.position);
+    std::vector<double> run;
+    int64_t k = 0;
+    while (k < count) {
+      const int64_t first = index(k);
+      int64_t kEnd = k + 1;
+      bool dense = true;
+      while (kEnd < count && index(kEnd) - index(kEnd - 1) <= maxGap &&
+             index(kEnd) - first < maxRunLength_) {
+        dense = dense && (index(kEnd) - index(kEnd - 1) == 1);
+        kEnd++;
+      }
+      const int64_t last = index(kEnd - 1);
+      if (dense) {
+        // dense run, read straight into the output
+        if (readDoubles(base + first, kEnd - k, out + k) !=
+            static_cast<size_t>(kEnd - k))
+          return false;
+      } else {
+        run.resize(last - first + 1);
+        if (readDoubles(base + first, last - first + 1, run.data()) !=
+            static_cast<size_t>(last - first + 1))
+          return false;
+        for (int64_t j = k; j < kEnd; j++)
+          out[j] = run[index(j) - first];
       }
+      k = kEnd;
+    }
+    return true;
+  }
 
-      // Set dimensions of array
-      // default constructor gives zeros for first time
-      auto &x = arrayDims[baseName];
-      x.l = a.length;
-      x.w++;
+  int fd_;            //< file descriptor, only used with pread
+  int directFd_ = -1; //< opened with O_DIRECT for direct streaming
+  std::string filename_;
+  StreamMode streamMode_ = cached;
+  std::shared_ptr<PIOBufferPool> pool_; //< staging buffers for direct
+  std::atomic<void *> map_{nullptr}; //< start of mapped file, or nullptr
+  size_t mapLength_ = 0;             //< length of mapping in bytes
+  std::mutex mapMutex_;              //< serializes mapFile()/unmapFile()
+  PIOHeader header_;
+  PIOStats *stats_;                    //< null unless instrumented
+  std::atomic<size_t> lastReadEnd_{0}; //< end of the last read [bytes]
 
-      // position set to next header
-      pos += header_.lengthIndex;
+  /** Reads the whole index block with one read and parses it in
+   *  memory.
+   **/
+  void loadArrayHeaders() {
+    std::vector<char> block;
+    {
+      PIOStats::Scope scope(stats_, "index", "readIndex");
+      block = readIndexBlock(fd_, header_);
+      if (stats_) {
+        size_t offset = 8 * static_cast<size_t>(header_.position);
+        stats_->countRead(block.size(),
+                          lastReadEnd_.exchange(offset + block.size()) !=
+                              offset);
+      }
     }
+    PIOStats::Scope scope(stats_, "index", "parseIndex");
+    parseIndex(header_, block, *index_);
   }
 };
 
+#endif
+
 // END
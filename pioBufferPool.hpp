@@ -0,0 +1,114 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOBUFFERPOOL_HPP_
+#define PIOBUFFERPOOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** Thread-safe pool of equally sized, aligned buffers, e.g. for
+ *  O_DIRECT reads, which need the buffer, offset and length aligned
+ *  to the device block size.
+ *
+ *    auto pool = std::make_shared<PIOBufferPool>(4 << 20);
+ *    {
+ *      PIOBufferPool::Buffer b = pool->acquire();
+ *      pread(fd, b.get(), pool->bufferBytes(), offset);
+ *    } // b goes back to the pool
+ *
+ *  Released buffers are kept for reuse, up to maxIdle of them, so a
+ *  streaming loop allocates only as many buffers as it has reads in
+ *  flight.  A Buffer keeps its pool alive, so buffers may outlive the
+ *  last other reference to the pool.
+ **/
+class PIOBufferPool : public std::enable_shared_from_this<PIOBufferPool> {
+public:
+  struct Release;
+  typedef std::unique_ptr<char, Release> Buffer;
+
+  /** Returns a buffer to its pool **/
+  struct Release {
+    std::shared_ptr<PIOBufferPool> pool;
+    void operator()(char *p) const { pool->release(p); }
+  };
+
+  PIOBufferPool(size_t bufferBytes = 4 << 20, size_t alignment = 4096,
+                size_t maxIdle = 64)
+      : alignment_(alignment),
+        bufferBytes_((std::max<size_t>(bufferBytes, 1) + alignment - 1) /
+                     alignment * alignment),
+        maxIdle_(maxIdle) {}
+  PIOBufferPool(const PIOBufferPool &) = delete;
+  PIOBufferPool &operator=(const PIOBufferPool &) = delete;
+  ~PIOBufferPool() {
+    for (char *p : idle_)
+      free(p);
+  }
+
+  size_t bufferBytes() const { return bufferBytes_; }
+  size_t alignment() const { return alignment_; }
+  uint64_t allocations() const { return allocations_; } //< buffers allocated
+
+  /** Hands out an idle buffer or allocates one; null if out of memory.
+   *  The pool must be owned by a shared_ptr.
+   **/
+  Buffer acquire() {
+    char *p = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!idle_.empty()) {
+        p = idle_.back();
+        idle_.pop_back();
+      }
+    }
+    if (!p) {
+      void *m = nullptr;
+      if (posix_memalign(&m, alignment_, bufferBytes_) != 0)
+        return Buffer(nullptr, Release{shared_from_this()});
+      p = static_cast<char *>(m);
+      allocations_++;
+    }
+    return Buffer(p, Release{shared_from_this()});
+  }
+
+private:
+  size_t alignment_;
+  size_t bufferBytes_;
+  size_t maxIdle_;
+  std::mutex mutex_; //< guards idle_
+  std::vector<char *> idle_;
+  std::atomic<uint64_t> allocations_{0};
+
+  void release(char *p) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (idle_.size() < maxIdle_) {
+        idle_.push_back(p);
+        return;
+      }
+    }
+    free(p);
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,125 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+// C entry points over PIO and PioInterface, used by piocpp.py through
+// ctypes.  See README.md for how to build the shared library.
+//
+// Arrays are never allocated here: the caller passes the buffer to be
+// filled (a NumPy array on the Python side), or gets a pointer into the
+// mapped file.  Functions returning a length return -1 on error.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pioInterface.hpp"
+
+extern "C" {
+
+void *pio_open(const char *filename, int useMmap, int verbose) {
+  PIO *p = new PIO(filename, verbose != 0, useMmap != 0);
+  if (p->arrayOrder.empty()) {
+    delete p;
+    return nullptr;
+  }
+  return p;
+}
+
+void pio_close(void *p) { delete static_cast<PIO *>(p); }
+
+int pio_mapped(void *p) { return static_cast<PIO *>(p)->mapped() ? 1 : 0; }
+
+/** length of array name (e.g. "pres_0"), -1 if it does not exist **/
+int64_t pio_array_length(void *p, const char *name) {
+  PIO *pio = static_cast<PIO *>(p);
+  auto it = pio->arrays.find(name);
+  return it == pio->arrays.end() ? -1
+                                 : static_cast<int64_t>(it->second.length);
+}
+
+/** Reads array name into out, which must hold pio_array_length()
+ *  values.  Returns the number of values read.
+ **/
+int64_t pio_read_array(void *p, const char *name, double *out) {
+  if (pio_array_length(p, name) < 0)
+    return -1;
+  return static_cast<PIO *>(p)->readArrayInto<double>(name, out);
+}
+
+/** As pio_read_array(), converting the values to integers **/
+int64_t pio_read_array_int(void *p, const char *name, int64_t *out) {
+  if (pio_array_length(p, name) < 0)
+    return -1;
+  return static_cast<PIO *>(p)->readArrayInto<int64_t>(name, out);
+}
+
+int64_t pio_read_array_range(void *p, const char *name, int64_t start,
+                             int64_t count, double *out) {
+  if (pio_array_length(p, name) < 0)
+    return -1;
+  return static_cast<PIO *>(p)->readArrayRangeInto(name, start, count, out);
+}
+
+/** Pointer to array name inside the mapped file, null if the file is
+ *  not mapped or the array does not exist.
+ **/
+const double *pio_array_view(void *p, const char *name, int64_t *length) {
+  PIOArrayView view = static_cast<PIO *>(p)->arrayView(name);
+  *length = view.size();
+  return view.data();
+}
+
+void *pio_interface_open(const char *filename, int nThreads) {
+  PioInterface *pi = new PioInterface(filename, 0, 0, nThreads);
+  if (pi->nCell() <= 0) {
+    delete pi;
+    return nullptr;
+  }
+  return pi;
+}
+
+void pio_interface_close(void *pi) { delete static_cast<PioInterface *>(pi); }
+
+int pio_interface_nmat(void *pi) {
+  return static_cast<PioInterface *>(pi)->nMat();
+}
+
+/** Expands material variable field (e.g. "chunk_vol") for materials
+ *  1..nRows into out [nRows][nCell], dividing by vcell if scale is
+ *  set.  Returns 0 on success.
+ **/
+int pio_expand_material(void *p, const char *field, int scale, int nRows,
+                        double *out) {
+  PioInterface *pi = static_cast<PioInterface *>(p);
+  const int64_t nCell = pi->nCell();
+  std::vector<double> invVolume;
+  if (scale) {
+    invVolume = pi->getInverseVolume();
+    if (invVolume.empty())
+      return 1;
+  }
+  PioMaterialView view = pi->getMaterialView(field);
+  if (view.empty())
+    return 1;
+  view.buildMaterialIndex();
+  for (int mat = 1; mat <= nRows; mat++)
+    view.expand(mat, out + (mat - 1) * nCell,
+                scale ? invVolume.data() : nullptr);
+  return 0;
+}
+
+} // extern "C"
+
+// END
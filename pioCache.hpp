@@ -0,0 +1,158 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOCACHE_HPP_
+#define PIOCACHE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Thread-safe cache of arrays read from dumps, limited to a budget
+ *  of bytes.
+ *
+ *  Arrays are handed out as shared read-only buffers: evicting an
+ *  array only drops the cache's reference, so callers holding it keep
+ *  a valid buffer.  When the cached bytes exceed the budget the least
+ *  recently used arrays are evicted; an array larger than the whole
+ *  budget is returned without being cached.  One cache may be shared
+ *  by several PioInterface objects and threads:
+ *
+ *    PIOArrayCache cache(4ull << 30);
+ *    PioInterface pi("run-dmp000010");
+ *    pi.setCache(&cache);
+ *    auto pres = pi.getSharedField("pres");  // read from the dump
+ *    auto again = pi.getSharedField("pres"); // same buffer, no read
+ **/
+class PIOArrayCache {
+public:
+  typedef std::shared_ptr<const std::vector<double>> Array;
+
+  PIOArrayCache(uint64_t budget = 1ull << 30) : budget_(budget) {}
+  PIOArrayCache(const PIOArrayCache &) = delete;
+  PIOArrayCache &operator=(const PIOArrayCache &) = delete;
+
+  uint64_t budget() const { return budget_; }
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+  uint64_t evictions() const { return evictions_; }
+  uint64_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  /** Changes the budget, evicting arrays if the cache is over it **/
+  void setBudget(uint64_t budget) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = budget;
+    evict();
+  }
+
+  /** Returns the array cached under key, or null (a miss) **/
+  Array find(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->data;
+  }
+
+  /** Caches data under key and returns it.  If key was cached in the
+   *  meantime (by another thread) that array is returned instead.
+   **/
+  Array insert(const std::string &key, std::vector<double> &&data) {
+    Array a = std::make_shared<const std::vector<double>>(std::move(data));
+    const uint64_t n = a->size() * sizeof(double);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end())
+      return it->second->data;
+    if (n > budget_)
+      return a;
+    entries_.push_front({key, a, n});
+    index_[key] = entries_.begin();
+    bytes_ += n;
+    evict();
+    return a;
+  }
+
+  /** Returns the array cached under key, calling load() to produce
+   *  it on a miss.  load() runs without the lock held, so threads
+   *  missing on the same key at once may each load it.
+   **/
+  template <typename F> Array get(const std::string &key, F load) {
+    Array a = find(key);
+    return a ? a : insert(key, load());
+  }
+
+  void erase(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+      return;
+    bytes_ -= it->second->bytes;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    bytes_ = 0;
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    Array data;
+    uint64_t bytes;
+  };
+
+  mutable std::mutex mutex_; //< guards everything but the counters
+  uint64_t budget_;
+  uint64_t bytes_ = 0;
+  std::list<Entry> entries_; //< most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> evictions_{0};
+
+  void evict() {
+    while (bytes_ > budget_ && !entries_.empty()) {
+      bytes_ -= entries_.back().bytes;
+      index_.erase(entries_.back().key);
+      entries_.pop_back();
+      evictions_++;
+    }
+  }
+};
+
+#endif
+
+// END
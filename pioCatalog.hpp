@@ -0,0 +1,348 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOCATALOG_HPP_
+#define PIOCATALOG_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glob.h>
+
+#include "pio.hpp"
+
+/** A series of dumps (typically the *-dmp000NNN files of one run)
+ *  opened together.  Dumps whose index blocks are identical share one
+ *  parsed PIOIndex.  With useSidecar set, the parsed indices of the
+ *  series are cached in one small <base>.pioidx file (see
+ *  sidecarName()): each distinct layout is stored once as a compact
+ *  table of names, lengths and positions, and each dump as its size,
+ *  modification time, header and layout.  Reopening the series then
+ *  reads that one file instead of the index of every dump.  A dump
+ *  whose size, modification time or header no longer match is read
+ *  from scratch and the sidecar rewritten, keeping the entries of
+ *  dumps of the series that were not opened.
+ **/
+class PioCatalog {
+public:
+  PioCatalog(const std::vector<std::string> &files, bool useSidecar = false,
+             bool useMmap = false, bool verbose = false)
+      : files_(files) {
+    std::map<uint64_t, std::shared_ptr<PIOIndex>> layouts;
+    std::map<std::string, SidecarDump> cached;
+    if (useSidecar && !files_.empty())
+      readSidecar(sidecarName(files_), layouts, cached);
+
+    bool stale = false;
+    std::vector<SidecarDump> dumps(files_.size());
+    for (size_t i = 0; i < files_.size(); i++) {
+      const std::string &f = files_[i];
+      std::unique_ptr<PIO> pio;
+      struct stat st;
+      auto c = cached.find(f);
+      if (c != cached.end() && stat(f.c_str(), &st) == 0 &&
+          c->second.fileSize == static_cast<uint64_t>(st.st_size) &&
+          c->second.mtimeSec == st.st_mtim.tv_sec &&
+          c->second.mtimeNsec == st.st_mtim.tv_nsec) {
+        // the header is read by the constructor anyway, so checking it
+        // costs nothing
+        pio.reset(new PIO(f, verbose, useMmap, layouts[c->second.checksum]));
+        PIOHeader h = pio->header();
+        if (!memcmp(&h, &c->second.header, sizeof(PIOHeader)))
+          dumps[i] = c->second;
+        else
+          pio.reset();
+      }
+      if (!pio) {
+        stale = true;
+        PIOHeader h;
+        std::vector<char> block;
+        std::shared_ptr<PIOIndex> index;
+        if (readIndex(f, h, block, st)) {
+          auto &shared = layouts[PIO::indexChecksum(h, block)];
+          if (!shared) {
+            shared = std::make_shared<PIOIndex>();
+            PIO::parseIndex(h, block, *shared);
+          }
+          index = shared;
+          dumps[i] = {static_cast<uint64_t>(st.st_size), st.st_mtim.tv_sec,
+                      st.st_mtim.tv_nsec, h, index->checksum};
+        }
+        pio.reset(new PIO(f, verbose, useMmap, index));
+      }
+      dumps_.push_back(std::move(pio));
+    }
+
+    std::set<uint64_t> used;
+    for (auto &d : dumps) {
+      if (d.checksum)
+        used.insert(d.checksum);
+    }
+    nLayouts_ = used.size();
+
+    // merge the dumps opened here into the entries of the sidecar, so
+    // that opening different subsets of a series does not make them
+    // replace each other
+    if (useSidecar && stale && !files_.empty()) {
+      for (size_t i = 0; i < files_.size(); i++) {
+        if (dumps[i].checksum)
+          cached[files_[i]] = dumps[i];
+        else
+          cached.erase(files_[i]);
+      }
+      used.clear();
+      for (auto &c : cached)
+        used.insert(c.second.checksum);
+      for (auto it = layouts.begin(); it != layouts.end();)
+        it = used.count(it->first) ? std::next(it) : layouts.erase(it);
+      if (!writeSidecar(sidecarName(files_), cached, layouts) && verbose)
+        std::cout << "Unable to write index sidecar " << sidecarName(files_)
+                  << std::endl;
+    }
+    if (verbose) {
+      std::cout << "Opened " << files_.size() << " dumps with " << nLayouts_
+                << " distinct index layouts" << std::endl;
+    }
+  }
+
+  /** Returns the sorted list of <base>-dmpNNNNNN files; names with
+   *  anything but digits after -dmp (sidecars, uniq maps) are skipped
+   **/
+  static std::vector<std::string> findSeries(const std::string &base) {
+    std::vector<std::string> files;
+    glob_t g;
+    std::string pattern = base + "-dmp[0-9]*";
+    const size_t digits = base.size() + 4;
+    if (glob(pattern.c_str(), 0, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; i++) {
+        std::string f(g.gl_pathv[i]);
+        if (f.find_first_not_of("0123456789", digits) == std::string::npos)
+          files.push_back(f);
+      }
+    }
+    globfree(&g);
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+  size_t size() { return dumps_.size(); }
+  PIO &dump(size_t i) { return *dumps_[i]; }
+  const std::string &filename(size_t i) { return files_[i]; }
+  size_t nLayouts() { return nLayouts_; } //< number of distinct indices
+
+  /** Reads variable name_index from every dump, nThreads dumps at a
+   *  time (0 uses all hardware threads).
+   **/
+  template <typename T = double>
+  std::vector<std::vector<T>> variableAll(std::string name, int index = 0,
+                                          int nThreads = 0) {
+    std::vector<std::vector<T>> result(dumps_.size());
+    pioParallelFor(dumps_.size(), nThreads, [&](int64_t i) {
+      result[i] = dumps_[i]->template variable<T>(name, index);
+    });
+    return result;
+  }
+
+  /** Name of the sidecar of a series: <base>.pioidx if the first file
+   *  is named <base>-dmpNNNNNN, <first file>.pioidx otherwise.
+   **/
+  static std::string sidecarName(const std::vector<std::string> &files) {
+    const std::string &f = files.front();
+    size_t p = f.rfind("-dmp");
+    if (p != std::string::npos && p + 4 < f.size() &&
+        f.find_first_not_of("0123456789", p + 4) == std::string::npos)
+      return f.substr(0, p) + sidecarSuffix();
+    return f + sidecarSuffix();
+  }
+
+private:
+  std::vector<std::string> files_;
+  std::vector<std::unique_ptr<PIO>> dumps_;
+  size_t nLayouts_ = 0;
+
+  static const std::string &sidecarSuffix() {
+    static const std::string suffix(".pioidx");
+    return suffix;
+  }
+
+  /** What the sidecar records about one dump **/
+  struct SidecarDump {
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    PIOHeader header;
+    uint64_t checksum; //< layout of the dump, 0 if it could not be read
+  };
+
+  static bool readHeader(int fd, PIOHeader &h) {
+    size_t n = PIO::preadFull(fd, 0, sizeof(PIOHeader), &h);
+    return n == sizeof(PIOHeader) && !strncmp(h.filetype, "pio_file", 8) &&
+           h.two == 2.0;
+  }
+
+  /** Reads header and raw index block straight from the dump, and the
+   *  dump's status into st
+   **/
+  static bool readIndex(const std::string &f, PIOHeader &h,
+                        std::vector<char> &block, struct stat &st) {
+    int fd = open(f.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    bool ok = fstat(fd, &st) == 0 && readHeader(fd, h);
+    if (ok) {
+      block = PIO::readIndexBlock(fd, h);
+      ok = block.size() == static_cast<size_t>(h.nArrays) * 8 *
+                               static_cast<size_t>(h.lengthIndex);
+    }
+    close(fd);
+    return ok;
+  }
+
+  /** Sidecar layout, all integers in native byte order:
+   *
+   *    "pioidx02"
+   *    nLayouts, then per layout: checksum, nArrays, then per array
+   *      the length of its base name, the name and its PIOArrayHeader
+   *    nDumps, then per dump: the length of its file name, the name
+   *      and its SidecarDump
+   **/
+  template <typename T> static void put(std::string &out, const T &v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+  }
+  static void putString(std::string &out, const std::string &v) {
+    put<uint32_t>(out, v.size());
+    out.append(v);
+  }
+
+  /** Bounds-checked cursor over the bytes of a sidecar **/
+  struct Cursor {
+    const char *p;
+    const char *end;
+    template <typename T> bool get(T &v) {
+      if (end - p < static_cast<ptrdiff_t>(sizeof(T)))
+        return false;
+      memcpy(&v, p, sizeof(T));
+      p += sizeof(T);
+      return true;
+    }
+    bool getString(std::string &v) {
+      uint32_t n;
+      if (!get(n) || end - p < static_cast<ptrdiff_t>(n))
+        return false;
+      v.assign(p, n);
+      p += n;
+      return true;
+    }
+  };
+
+  /** Loads the layouts and dumps recorded in sidecar name.  Leaves
+   *  both empty if there is none or it is damaged.
+   **/
+  static void
+  readSidecar(const std::string &name,
+              std::map<uint64_t, std::shared_ptr<PIOIndex>> &layouts,
+              std::map<std::string, SidecarDump> &dumps) {
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    std::vector<char> bytes;
+    if (fstat(fd, &st) == 0) {
+      bytes.resize(st.st_size);
+      bytes.resize(PIO::preadFull(fd, 0, bytes.size(), bytes.data()));
+    }
+    close(fd);
+
+    Cursor c{bytes.data(), bytes.data() + bytes.size()};
+    char magic[8];
+    uint64_t nLayouts = 0, nDumps = 0;
+    bool ok = c.get(magic) && !memcmp(magic, "pioidx02", 8) && c.get(nLayouts);
+    std::string baseName, file;
+    for (uint64_t l = 0; ok && l < nLayouts; l++) {
+      uint64_t checksum = 0, nArrays = 0;
+      ok = c.get(checksum) && c.get(nArrays);
+      auto index = std::make_shared<PIOIndex>();
+      index->checksum = checksum;
+      for (uint64_t i = 0; ok && i < nArrays; i++) {
+        PIOArrayHeader a;
+        ok = c.getString(baseName) && c.get(a);
+        if (ok)
+          PIO::addIndexEntry(baseName, a, *index);
+      }
+      layouts[checksum] = index;
+    }
+    ok = ok && c.get(nDumps);
+    for (uint64_t d = 0; ok && d < nDumps; d++) {
+      SidecarDump s;
+      ok = c.getString(file) && c.get(s) &&
+           (s.checksum == 0 || layouts.count(s.checksum));
+      if (ok && s.checksum)
+        dumps[file] = s;
+    }
+    if (!ok) {
+      layouts.clear();
+      dumps.clear();
+    }
+  }
+
+  static bool
+  writeSidecar(const std::string &name,
+               const std::map<std::string, SidecarDump> &dumps,
+               const std::map<uint64_t, std::shared_ptr<PIOIndex>> &layouts) {
+    std::string out("pioidx02");
+    put<uint64_t>(out, layouts.size());
+    for (auto &l : layouts) {
+      const PIOIndex &idx = *l.second;
+      put<uint64_t>(out, l.first);
+      put<uint64_t>(out, idx.arrayOrder.size());
+      for (auto &n : idx.arrayOrder) {
+        const PIOArrayHeader &a = idx.arrays.at(n);
+        // strip the _<index> that parseIndex() appended
+        size_t suffix = std::to_string(static_cast<int>(a.index)).size() + 1;
+        putString(out, n.substr(0, n.size() - suffix));
+        put(out, a);
+      }
+    }
+    put<uint64_t>(out, dumps.size());
+    for (auto &d : dumps) {
+      putString(out, d.first);
+      put(out, d.second);
+    }
+
+    // write to a temporary name and rename so readers never see a
+    // partially written sidecar
+    std::string tmp = name + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+      return false;
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+      ok = rename(tmp.c_str(), name.c_str()) == 0;
+    if (!ok)
+      unlink(tmp.c_str());
+    return ok;
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,586 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOCOLUMNAR_HPP_
+#define PIOCOLUMNAR_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pio.hpp"
+
+/** Options for PioColumnar::transcode() **/
+struct PioColumnarOptions {
+  int64_t chunkSize = 1 << 16; //< values per chunk
+  bool shuffle = true;         //< byte-shuffle chunks before compressing
+  bool compress = true;        //< run-length encode chunks when smaller
+  int nThreads = 0;            //< 0 uses all hardware threads
+};
+
+/** Zone map entry of one chunk: values [start, start + count) of an
+ *  array lie in [min, max].  NaNs are not counted in min and max but
+ *  flagged in hasNaN.
+ **/
+struct PioChunkInfo {
+  int64_t start;
+  int64_t count;
+  double min;
+  double max;
+  bool hasNaN;
+};
+
+#pragma pack(push, 1)
+struct PioColumnarHeader {
+  char magic[8];            //< "piocol01"
+  uint64_t dumpSize;        //< size of the source dump [bytes]
+  int64_t mtimeSec;         //< modification time of the source dump
+  int64_t mtimeNsec;
+  uint64_t checksum;        //< PIO::indexChecksum() of the source dump
+  uint64_t chunkSize;
+  uint64_t nArrays;
+  uint64_t directoryOffset; //< [bytes]
+  uint64_t directoryBytes;
+  int64_t numcell;
+  int64_t ndim;
+};
+
+struct PioColumnarChunk {
+  uint64_t offset; //< [bytes]
+  uint64_t bytes;  //< stored size [bytes]
+  double min;
+  double max;
+  int64_t base;  //< integer chunks store value - base
+  uint8_t width; //< bytes per stored value, 0 if all values equal base
+  uint8_t flags;
+  uint8_t pad[6];
+};
+#pragma pack(pop)
+
+/** Chunked columnar copy of a PIO dump.
+ *
+ *  transcode() rewrites every array of a dump as chunks of chunkSize
+ *  values.  A chunk whose values are all integers is stored as
+ *  unsigned offsets from the chunk minimum in the narrowest of 0
+ *  (constant), 1, 2, 4 or 8 bytes; other chunks keep their doubles.
+ *  Each chunk is then optionally byte-shuffled (all first bytes, then
+ *  all second bytes, ...) and run-length encoded when that makes it
+ *  smaller.  The per-chunk min/max zone maps let callers skip chunks
+ *  that cannot match a filter.  Decoding is lossless: readArray()
+ *  returns the same bits as PIO::readArray().
+ *
+ *  The file records the size, modification time and index checksum
+ *  of its dump; matches() tells whether it is still current.
+ *
+ *    PioColumnar::transcode("run-dmp000010");
+ *    PioColumnar c(PioColumnar::sidecarName("run-dmp000010"));
+ *    std::vector<double> p = c.readArray("pres_0");
+ **/
+class PioColumnar {
+public:
+  PioColumnar(const std::string &filename, int nThreads = 0,
+              PIOStats *stats = nullptr)
+      : nThreads_(nThreads), stats_(stats) {
+    memset(&header_, 0, sizeof(header_));
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      std::cout << "Unable to open file " << filename << std::endl;
+      return;
+    }
+    if (PIO::preadFull(fd_, 0, sizeof(header_), &header_) != sizeof(header_) ||
+        memcmp(header_.magic, "piocol01", 8)) {
+      std::cout << "Not a columnar PIO file: " << filename << std::endl;
+      memset(&header_, 0, sizeof(header_));
+      return;
+    }
+    std::vector<char> dir(header_.directoryBytes);
+    if (PIO::preadFull(fd_, header_.directoryOffset, dir.size(), dir.data()) !=
+            dir.size() ||
+        !parseDirectory(dir)) {
+      std::cout << "Unable to read directory of " << filename << std::endl;
+      arrayOrder.clear();
+      columns_.clear();
+    }
+  }
+  PioColumnar(const PioColumnar &) = delete;
+  PioColumnar &operator=(const PioColumnar &) = delete;
+  ~PioColumnar() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  std::vector<std::string> arrayOrder; //< array names (name_index)
+
+  int ndim() { return header_.ndim; }
+  int64_t numcell() { return header_.numcell; }
+  int64_t chunkSize() { return header_.chunkSize; } //< values per chunk
+  bool has(const std::string &name) { return columns_.count(name) != 0; }
+  int64_t length(const std::string &name) {
+    auto it = columns_.find(name);
+    return it == columns_.end() ? 0 : it->second.length;
+  }
+  /** bytes of array name as stored, to compare with 8 * length **/
+  uint64_t storedBytes(const std::string &name) {
+    uint64_t n = 0;
+    auto it = columns_.find(name);
+    if (it != columns_.end()) {
+      for (auto &c : it->second.chunks)
+        n += c.bytes;
+    }
+    return n;
+  }
+
+  /** Zone map of array name, one entry per chunk **/
+  std::vector<PioChunkInfo> chunks(const std::string &name) {
+    std::vector<PioChunkInfo> info;
+    auto it = columns_.find(name);
+    if (it == columns_.end())
+      return info;
+    const int64_t chunkSize = header_.chunkSize;
+    const auto &col = it->second;
+    for (size_t k = 0; k < col.chunks.size(); k++) {
+      const auto &c = col.chunks[k];
+      const int64_t start = k * chunkSize;
+      info.push_back({start, std::min(chunkSize, col.length - start), c.min,
+                      c.max, (c.flags & hasNaN) != 0});
+    }
+    return info;
+  }
+
+  std::vector<double> variable(std::string name, int index = 0) {
+    return readArray(name + "_" + std::to_string(index));
+  }
+
+  template <typename T>
+  std::vector<T> variable(std::string name, int index = 0) {
+    std::vector<double> d = variable(name, index);
+    return std::vector<T>(d.begin(), d.end());
+  }
+
+  /** Same as PIO::readArray(): the whole array, empty if missing or
+   *  if a chunk cannot be read or decoded.
+   **/
+  std::vector<double> readArray(std::string name) {
+    std::vector<double> v;
+    auto it = columns_.find(name);
+    if (it == columns_.end())
+      return v;
+    PIOStats::Scope scope(stats_, "array", name);
+    v.resize(it->second.length);
+    const auto &col = it->second;
+    std::atomic<bool> ok(true);
+    pioParallelFor(col.chunks.size(), nThreads_, [&](int64_t k) {
+      if (readChunk(col, k, v.data() + k * header_.chunkSize) !=
+          chunkLength(col, k))
+        ok = false;
+    });
+    if (!ok)
+      v.clear();
+    return v;
+  }
+
+  /** Same as PIO::readArrayRange(); only the chunks overlapping the
+   *  range are read.  Empty if a chunk cannot be read or decoded.
+   **/
+  std::vector<double> readArrayRange(std::string name, int64_t start,
+                                     int64_t count) {
+    std::vector<double> v;
+    auto it = columns_.find(name);
+    if (it == columns_.end() || start < 0)
+      return v;
+    const auto &col = it->second;
+    count = std::max<int64_t>(0, std::min(count, col.length - start));
+    if (count == 0)
+      return v;
+    PIOStats::Scope scope(stats_, "array", name);
+    v.resize(count);
+    const int64_t chunkSize = header_.chunkSize;
+    const int64_t k0 = start / chunkSize;
+    const int64_t k1 = (start + count - 1) / chunkSize;
+    std::atomic<bool> ok(true);
+    pioParallelFor(k1 - k0 + 1, nThreads_, [&](int64_t j) {
+      const int64_t k = k0 + j;
+      std::vector<double> buffer(chunkSize);
+      int64_t n = readChunk(col, k, buffer.data());
+      if (n != chunkLength(col, k)) {
+        ok = false;
+        return;
+      }
+      const int64_t first = std::max(start, k * chunkSize);
+      const int64_t last = std::min(start + count, k * chunkSize + n);
+      std::copy(buffer.begin() + (first - k * chunkSize),
+                buffer.begin() + (last - k * chunkSize),
+                v.begin() + (first - start));
+    });
+    if (!ok)
+      v.clear();
+    return v;
+  }
+
+  /** Decodes chunk k of array name into out (chunkSize values at
+   *  most).  Returns the number of values, 0 on error.
+   **/
+  int64_t readChunk(const std::string &name, int64_t k, double *out) {
+    auto it = columns_.find(name);
+    if (it == columns_.end() || k < 0 ||
+        k >= static_cast<int64_t>(it->second.chunks.size()))
+      return 0;
+    return readChunk(it->second, k, out);
+  }
+
+  static std::string sidecarName(const std::string &dump) {
+    return dump + ".pioc";
+  }
+
+  /** true if this file was transcoded from dump as it is now **/
+  bool matches(const std::string &dump) {
+    struct stat st;
+    if (stat(dump.c_str(), &st) != 0)
+      return false;
+    if (header_.dumpSize != static_cast<uint64_t>(st.st_size) ||
+        header_.mtimeSec != st.st_mtim.tv_sec ||
+        header_.mtimeNsec != st.st_mtim.tv_nsec)
+      return false;
+    PIO pio(dump);
+    return pio.index()->checksum == header_.checksum;
+  }
+
+  /** Writes the columnar copy of dump to out (sidecarName(dump) if
+   *  empty).  Returns false on error.
+   **/
+  static bool transcode(const std::string &dump, std::string out = "",
+                        const PioColumnarOptions &options =
+                            PioColumnarOptions()) {
+    if (out.empty())
+      out = sidecarName(dump);
+    struct stat st;
+    if (stat(dump.c_str(), &st) != 0)
+      return false;
+    PIO pio(dump);
+    if (pio.arrayOrder.empty())
+      return false;
+    const int64_t chunkSize = std::max<int64_t>(1, options.chunkSize);
+
+    std::string tmp = out + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+      return false;
+    PioColumnarHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "piocol01", 8);
+    h.dumpSize = st.st_size;
+    h.mtimeSec = st.st_mtim.tv_sec;
+    h.mtimeNsec = st.st_mtim.tv_nsec;
+    h.checksum = pio.index()->checksum;
+    h.chunkSize = chunkSize;
+    h.nArrays = pio.arrayOrder.size();
+    h.numcell = pio.numcell();
+    h.ndim = pio.ndim();
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+
+    // arrays one at a time, their chunks encoded in parallel
+    std::vector<char> dir;
+    uint64_t offset = sizeof(h);
+    for (size_t a = 0; a < pio.arrayOrder.size() && ok; a++) {
+      const std::string &name = pio.arrayOrder[a];
+      std::vector<double> v = pio.readArray(name);
+      const int64_t nChunks = (v.size() + chunkSize - 1) / chunkSize;
+      std::vector<PioColumnarChunk> entries(nChunks);
+      std::vector<std::vector<uint8_t>> data(nChunks);
+      pioParallelFor(nChunks, options.nThreads, [&](int64_t k) {
+        const int64_t n =
+            std::min<int64_t>(chunkSize, v.size() - k * chunkSize);
+        encodeChunk(v.data() + k * chunkSize, n, options, entries[k], data[k]);
+      });
+      for (int64_t k = 0; k < nChunks && ok; k++) {
+        entries[k].offset = offset;
+        offset += data[k].size();
+        ok = fwrite(data[k].data(), 1, data[k].size(), fp) == data[k].size();
+      }
+      uint32_t l = name.size();
+      uint64_t counts[2] = {v.size(), static_cast<uint64_t>(nChunks)};
+      append(dir, &l, sizeof(l));
+      append(dir, name.data(), l);
+      append(dir, counts, sizeof(counts));
+      append(dir, entries.data(), nChunks * sizeof(PioColumnarChunk));
+    }
+    h.directoryOffset = offset;
+    h.directoryBytes = dir.size();
+    ok = ok && fwrite(dir.data(), 1, dir.size(), fp) == dir.size() &&
+         fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+      ok = rename(tmp.c_str(), out.c_str()) == 0;
+    if (!ok)
+      unlink(tmp.c_str());
+    return ok;
+  }
+
+private:
+  enum : uint8_t { isInteger = 1, isShuffled = 2, isRle = 4, hasNaN = 8 };
+
+  struct Column {
+    int64_t length;
+    std::vector<PioColumnarChunk> chunks;
+  };
+
+  int fd_ = -1;
+  int nThreads_;
+  PIOStats *stats_;
+  PioColumnarHeader header_;
+  std::unordered_map<std::string, Column> columns_;
+
+  static void append(std::vector<char> &b, const void *p, size_t n) {
+    const char *c = static_cast<const char *>(p);
+    b.insert(b.end(), c, c + n);
+  }
+
+  bool parseDirectory(const std::vector<char> &dir) {
+    size_t p = 0;
+    auto take = [&](void *out, size_t n) {
+      if (p + n > dir.size())
+        return false;
+      memcpy(out, dir.data() + p, n);
+      p += n;
+      return true;
+    };
+    for (uint64_t a = 0; a < header_.nArrays; a++) {
+      uint32_t l;
+      uint64_t counts[2];
+      if (!take(&l, sizeof(l)) || p + l > dir.size())
+        return false;
+      std::string name(dir.data() + p, l);
+      p += l;
+      if (!take(counts, sizeof(counts)))
+        return false;
+      Column &col = columns_[name];
+      col.length = counts[0];
+      col.chunks.resize(counts[1]);
+      if (!take(col.chunks.data(), counts[1] * sizeof(PioColumnarChunk)))
+        return false;
+      arrayOrder.push_back(name);
+    }
+    return true;
+  }
+
+  /** number of values in chunk k of col **/
+  int64_t chunkLength(const Column &col, int64_t k) const {
+    return std::min<int64_t>(header_.chunkSize,
+                             col.length - k * header_.chunkSize);
+  }
+
+  /** Decodes chunk k of col into out, returns the number of values **/
+  int64_t readChunk(const Column &col, int64_t k, double *out) {
+    const PioColumnarChunk &c = col.chunks[k];
+    const int64_t n = chunkLength(col, k);
+    const size_t raw = n * (c.flags & isInteger ? c.width : sizeof(double));
+    std::vector<uint8_t> stored(c.bytes);
+    if (PIO::preadFull(fd_, c.offset, c.bytes, stored.data()) != c.bytes)
+      return 0;
+    if (stats_)
+      stats_->countRead(c.bytes, false);
+
+    std::vector<uint8_t> bytes;
+    if (c.flags & isRle) {
+      if (!rleDecode(stored, raw, bytes))
+        return 0;
+    } else {
+      bytes.swap(stored);
+    }
+    if (bytes.size() != raw)
+      return 0;
+    const bool shuffled = (c.flags & isShuffled) != 0;
+    if (!(c.flags & isInteger)) {
+      if (shuffled)
+        unshuffle<uint64_t>(bytes.data(), n, out);
+      else
+        memcpy(out, bytes.data(), raw);
+      return n;
+    }
+    switch (c.width) {
+    case 0:
+      std::fill(out, out + n, static_cast<double>(c.base));
+      break;
+    case 1:
+      decodeInts<uint8_t>(bytes.data(), n, false, c.base, out);
+      break;
+    case 2:
+      decodeInts<uint16_t>(bytes.data(), n, shuffled, c.base, out);
+      break;
+    case 4:
+      decodeInts<uint32_t>(bytes.data(), n, shuffled, c.base, out);
+      break;
+    default:
+      decodeInts<uint64_t>(bytes.data(), n, shuffled, c.base, out);
+    }
+    return n;
+  }
+
+  /** Undoes the byte shuffle of n values of type U from in to out **/
+  template <typename U>
+  static void unshuffle(const uint8_t *in, int64_t n, void *out) {
+    uint8_t *o = static_cast<uint8_t *>(out);
+    for (size_t b = 0; b < sizeof(U); b++) {
+      const uint8_t *src = in + b * n;
+      for (int64_t i = 0; i < n; i++)
+        o[i * sizeof(U) + b] = src[i];
+    }
+  }
+
+  /** base + the n unsigned offsets of type U stored at in **/
+  template <typename U>
+  static void decodeInts(const uint8_t *in, int64_t n, bool shuffled,
+                         int64_t base, double *out) {
+    std::vector<U> u(n);
+    if (shuffled)
+      unshuffle<U>(in, n, u.data());
+    else
+      memcpy(u.data(), in, n * sizeof(U)); // little endian
+    const uint64_t b = base;
+    for (int64_t i = 0; i < n; i++)
+      out[i] = static_cast<double>(static_cast<int64_t>(b + u[i]));
+  }
+
+  static void encodeChunk(const double *v, int64_t n,
+                          const PioColumnarOptions &options,
+                          PioColumnarChunk &c, std::vector<uint8_t> &out) {
+    memset(&c, 0, sizeof(c));
+    c.min = HUGE_VAL;
+    c.max = -HUGE_VAL;
+    bool integer = true;
+    for (int64_t i = 0; i < n; i++) {
+      const double x = v[i];
+      if (std::isnan(x)) {
+        c.flags |= hasNaN;
+        integer = false;
+        continue;
+      }
+      c.min = std::min(c.min, x);
+      c.max = std::max(c.max, x);
+      // -0.0 and values outside int64 would not come back bit for bit
+      integer = integer && x == std::floor(x) && x >= -9.0e18 &&
+                x <= 9.0e18 && !(x == 0.0 && std::signbit(x));
+    }
+
+    std::vector<uint8_t> bytes;
+    int width = sizeof(double);
+    if (integer && n > 0) {
+      c.flags |= isInteger;
+      c.base = static_cast<int64_t>(c.min);
+      // offsets are computed unsigned so that any int64 range fits
+      const uint64_t base = c.base;
+      const uint64_t range = static_cast<int64_t>(c.max) - base;
+      width = 8;
+      if (range < (1ull << 32))
+        width = 4;
+      if (range < (1ull << 16))
+        width = 2;
+      if (range < (1ull << 8))
+        width = 1;
+      if (range == 0)
+        width = 0;
+      c.width = width;
+      bytes.resize(n * width);
+      for (int64_t i = 0; i < n && width > 0; i++) {
+        uint64_t u = static_cast<int64_t>(v[i]) - base;
+        memcpy(bytes.data() + i * width, &u, width); // little endian
+      }
+    } else {
+      c.width = width;
+      bytes.resize(n * width);
+      memcpy(bytes.data(), v, bytes.size());
+    }
+
+    if (options.shuffle && width > 1) {
+      std::vector<uint8_t> s(bytes.size());
+      for (int64_t i = 0; i < n; i++)
+        for (int b = 0; b < width; b++)
+          s[b * n + i] = bytes[i * width + b];
+      bytes.swap(s);
+      c.flags |= isShuffled;
+    }
+    if (options.compress && !bytes.empty()) {
+      rleEncode(bytes, out);
+      if (out.size() < bytes.size()) {
+        c.flags |= isRle;
+        c.bytes = out.size();
+        return;
+      }
+    }
+    out.swap(bytes);
+    c.bytes = out.size();
+  }
+
+  // Run-length coding in the PackBits style: a control byte c < 128
+  // is followed by c + 1 literal bytes, c >= 128 by one byte repeated
+  // c - 125 times.
+  static void rleEncode(const std::vector<uint8_t> &in,
+                        std::vector<uint8_t> &out) {
+    out.clear();
+    out.reserve(in.size() / 2);
+    const size_t n = in.size();
+    size_t i = 0;
+    while (i < n) {
+      size_t run = 1;
+      while (i + run < n && run < 130 && in[i + run] == in[i])
+        run++;
+      if (run >= 3) {
+        out.push_back(static_cast<uint8_t>(125 + run));
+        out.push_back(in[i]);
+        i += run;
+        continue;
+      }
+      // literals up to the next run of three or 128 bytes
+      size_t j = i;
+      while (j < n && j - i < 128 &&
+             !(j + 2 < n && in[j] == in[j + 1] && in[j] == in[j + 2]))
+        j++;
+      out.push_back(static_cast<uint8_t>(j - i - 1));
+      out.insert(out.end(), in.begin() + i, in.begin() + j);
+      i = j;
+    }
+  }
+
+  static bool rleDecode(const std::vector<uint8_t> &in, size_t n,
+                        std::vector<uint8_t> &out) {
+    out.resize(n);
+    uint8_t *o = out.data();
+    size_t p = 0, q = 0;
+    while (p < in.size()) {
+      const size_t c = in[p++];
+      if (c < 128) {
+        if (p + c + 1 > in.size() || q + c + 1 > n)
+          return false;
+        memcpy(o + q, in.data() + p, c + 1);
+        p += c + 1;
+        q += c + 1;
+      } else {
+        if (p >= in.size() || q + c - 125 > n)
+          return false;
+        memset(o + q, in[p++], c - 125);
+        q += c - 125;
+      }
+    }
+    return q == n;
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,470 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIODIFF_HPP_
+#define PIODIFF_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pioInterface.hpp"
+
+/** Tolerances and limits of PioDiff.  Two values agree if they are
+ *  equal (NaN agrees with NaN) or within any one of the tolerances;
+ *  with all tolerances 0 only equal values agree.
+ **/
+struct PioDiffOptions {
+  double absTol = 0.0;       //< |a - b| <= absTol
+  double relTol = 0.0;       //< |a - b| <= relTol * max(|a|, |b|)
+  uint64_t ulpTol = 0;       //< at most ulpTol doubles apart
+  int maxReport = 10;        //< offending cells kept per array
+  int64_t blockSize = 1 << 16;
+  int nThreads = 0;          //< 0 uses all hardware threads
+  std::vector<std::string> arrays; //< arrays to compare, empty for all
+};
+
+/** A value that differs between the two dumps **/
+struct PioCellDiff {
+  int64_t cell;  //< index in the first dump (element for other arrays)
+  int64_t other; //< matching index in the second dump, -1 if none
+  int mat;       //< material id for material arrays, 0 otherwise
+  double a;      //< value in the first dump, NaN if missing
+  double b;      //< value in the second dump, NaN if missing
+};
+
+/** Result of comparing one array **/
+struct PioArrayDiff {
+  std::string name;
+  std::string note;     //< why the array was not compared, empty if it was
+  int64_t compared = 0; //< values compared
+  int64_t differing = 0;
+  int64_t unread = 0;   //< values skipped because a read came up short
+  double maxAbs = 0.0; //< largest |a - b|
+  double maxRel = 0.0; //< largest |a - b| / max(|a|, |b|)
+  uint64_t maxUlp = 0; //< largest distance in units of the last place
+  std::vector<PioCellDiff> first; //< lowest offending cells, at most
+                                  // maxReport
+
+  bool same() const {
+    return note.empty() && differing == 0 && unread == 0;
+  }
+};
+
+/** Compares two dumps of the same problem, run on different numbers
+ *  of processors, cell by cell.
+ *
+ *  Cells are matched through the unique ids of PioInterface, so both
+ *  interfaces must be opened with uniq set; without it cells are
+ *  matched by index.  Cell arrays are compared value by value,
+ *  material (chunk_) arrays entry by entry for the same material of
+ *  matching cells, cell_daughter through the unique ids of the
+ *  daughters, and every other array element by element.
+ *
+ *    PioInterface a("run16-dmp000100", 1), b("run64-dmp000100", 1);
+ *    PioDiffOptions o;
+ *    o.relTol = 1e-12;
+ *    PioDiff diff(a, b, o);
+ *    auto result = diff.run();
+ *    diff.print(stdout, result);
+ *
+ *  Work is split into (array, block of cells) tasks run in parallel
+ *  with per-thread results merged at the end.  A task reads its block
+ *  of the first dump with one read and the matching cells of the
+ *  second with a sorted gather, so only a block per thread is held
+ *  besides the cell matching (two int64_t per cell).
+ **/
+class PioDiff {
+public:
+  PioDiff(PioInterface &a, PioInterface &b,
+          const PioDiffOptions &options = PioDiffOptions())
+      : a_(a), b_(b), options_(options) {
+    options_.blockSize = std::max<int64_t>(1, options_.blockSize);
+    options_.maxReport = std::max(0, options_.maxReport);
+  }
+
+  /** Compares the arrays; one result per array in either dump, in
+   *  the order of the first dump followed by arrays only in the second.
+   **/
+  std::vector<PioArrayDiff> run() {
+    PIOStats::Scope scope(a_.stats(), "phase", "diff");
+    PIO &pa = a_.pio(), &pb = b_.pio();
+    std::vector<PioArrayDiff> result;
+    std::vector<Kind> kinds;
+    const bool sameCells = a_.nCell() == b_.nCell();
+    if (sameCells)
+      matchCells();
+    const int64_t csrLength = sameCells ? a_.matIds().size() : -1;
+    const bool sameCsr =
+        sameCells && csrLength == int64_t(b_.matIds().size());
+    auto selected = [&](const std::string &name) {
+      return options_.arrays.empty() ||
+             std::find(options_.arrays.begin(), options_.arrays.end(),
+                       name) != options_.arrays.end();
+    };
+    for (auto &name : pa.arrayOrder) {
+      if (!selected(name))
+        continue;
+      PioArrayDiff r;
+      r.name = name;
+      Kind k = none;
+      auto ib = pb.arrays.find(name);
+      const int64_t length = pa.arrays.at(name).length;
+      if (ib == pb.arrays.end())
+        r.note = "only in first dump";
+      else if (int64_t(ib->second.length) != length)
+        r.note = "lengths differ";
+      else if (name == "cell_daughter_0" && sameCells &&
+               length == a_.nCell())
+        k = daughter;
+      else if (name.compare(0, 6, "chunk_") == 0 && sameCsr &&
+               length == csrLength && length != a_.nCell())
+        k = material;
+      else if (sameCells && length == a_.nCell())
+        k = cell;
+      else if (name.compare(0, 6, "chunk_") == 0 && length == csrLength)
+        r.note = "material layouts differ";
+      else if (length == a_.nCell() && !sameCells)
+        r.note = "cell counts differ";
+      else
+        k = element;
+      result.push_back(r);
+      kinds.push_back(k);
+    }
+    for (auto &name : pb.arrayOrder) {
+      if (selected(name) && !pa.arrays.count(name)) {
+        PioArrayDiff r;
+        r.name = name;
+        r.note = "only in second dump";
+        result.push_back(r);
+        kinds.push_back(none);
+      }
+    }
+
+    // (array, block) tasks, array major so that each thread sees the
+    // blocks of an array in increasing order
+    struct Task {
+      int array;
+      int64_t block;
+    };
+    std::vector<Task> tasks;
+    for (size_t i = 0; i < result.size(); i++) {
+      if (kinds[i] == none)
+        continue;
+      const int64_t n = kinds[i] == element
+                            ? int64_t(pa.arrays.at(result[i].name).length)
+                            : a_.nCell();
+      const int64_t nBlocks = (n + options_.blockSize - 1) / options_.blockSize;
+      for (int64_t b = 0; b < nBlocks; b++)
+        tasks.push_back({int(i), b});
+    }
+    int nWorkers = options_.nThreads;
+    if (nWorkers <= 0)
+      nWorkers = std::max(1u, std::thread::hardware_concurrency());
+    nWorkers = std::max<int64_t>(1, std::min<int64_t>(nWorkers, tasks.size()));
+    std::vector<std::vector<PioArrayDiff>> acc(nWorkers, result);
+    std::atomic<int64_t> next(0);
+    pioParallelFor(nWorkers, nWorkers, [&](int64_t w) {
+      Buffers buf;
+      for (int64_t t = next++; t < int64_t(tasks.size()); t = next++) {
+        PioArrayDiff &r = acc[w][tasks[t].array];
+        switch (kinds[tasks[t].array]) {
+        case cell:
+        case daughter:
+          compareCells(r, tasks[t].block, kinds[tasks[t].array] == daughter,
+                       buf);
+          break;
+        case material:
+          compareMaterials(r, tasks[t].block, buf);
+          break;
+        default:
+          compareElements(r, tasks[t].block, buf);
+        }
+      }
+    });
+
+    // merge the per-thread results
+    for (size_t i = 0; i < result.size(); i++) {
+      PioArrayDiff &r = result[i];
+      for (auto &a : acc) {
+        const PioArrayDiff &p = a[i];
+        r.compared += p.compared;
+        r.differing += p.differing;
+        r.unread += p.unread;
+        r.maxAbs = std::max(r.maxAbs, p.maxAbs);
+        r.maxRel = std::max(r.maxRel, p.maxRel);
+        r.maxUlp = std::max(r.maxUlp, p.maxUlp);
+        r.first.insert(r.first.end(), p.first.begin(), p.first.end());
+      }
+      std::sort(r.first.begin(), r.first.end(),
+                [](const PioCellDiff &x, const PioCellDiff &y) {
+                  return x.cell < y.cell || (x.cell == y.cell && x.mat < y.mat);
+                });
+      if (int(r.first.size()) > options_.maxReport)
+        r.first.resize(options_.maxReport);
+    }
+    return result;
+  }
+
+  /** true if every array in result was compared and agrees **/
+  static bool same(const std::vector<PioArrayDiff> &result) {
+    for (auto &r : result) {
+      if (!r.same())
+        return false;
+    }
+    return true;
+  }
+
+  /** Prints the arrays that differ and their first offending cells **/
+  static void print(FILE *fp, const std::vector<PioArrayDiff> &result) {
+    for (auto &r : result) {
+      if (r.same())
+        continue;
+      if (!r.note.empty()) {
+        fprintf(fp, "%-32s %s\n", r.name.c_str(), r.note.c_str());
+        continue;
+      }
+      fprintf(fp,
+              "%-32s %ld of %ld differ, max abs %.6e, max rel %.6e, "
+              "max ulp %llu\n",
+              r.name.c_str(), long(r.differing), long(r.compared), r.maxAbs,
+              r.maxRel, (unsigned long long)r.maxUlp);
+      if (r.unread)
+        fprintf(fp, "    %ld values could not be read\n", long(r.unread));
+      for (auto &c : r.first) {
+        fprintf(fp, "    cell %ld / %ld", long(c.cell), long(c.other));
+        if (c.mat)
+          fprintf(fp, " mat %d", c.mat);
+        fprintf(fp, ": %.17g %.17g\n", c.a, c.b);
+      }
+    }
+  }
+
+private:
+  enum Kind { none, cell, daughter, material, element };
+
+  struct Buffers {
+    std::vector<double> a, b, gathered;
+    std::vector<int64_t> index;
+  };
+
+  PioInterface &a_;
+  PioInterface &b_;
+  PioDiffOptions options_;
+  std::vector<int64_t> other_;  //< cell of the second dump matching each
+                                // cell of the first [nCell]
+  std::vector<int64_t> sorted_; //< other_ sorted within each block [nCell]
+  std::vector<int64_t> uniqA_, uniqB_; //< unique id of each cell [nCell]
+
+  /** Builds other_ and, per block, the matching cells of the second
+   *  dump in ascending order with their position in the block.
+   **/
+  void matchCells() {
+    if (!other_.empty() || a_.nCell() == 0)
+      return;
+    const int64_t nCell = a_.nCell();
+    const int64_t *mapA = a_.uniqMap(), *mapB = b_.uniqMap();
+    const int64_t blockSize = options_.blockSize;
+    const int64_t nBlocks = (nCell + blockSize - 1) / blockSize;
+    other_.resize(nCell);
+    uniqA_.resize(nCell);
+    uniqB_.resize(nCell);
+    sorted_.resize(nCell);
+    pioParallelFor(nBlocks, options_.nThreads, [&](int64_t blk) {
+      const int64_t end = std::min(nCell, (blk + 1) * blockSize);
+      for (int64_t u = blk * blockSize; u < end; u++) {
+        uniqA_[mapA && mapB ? mapA[u] : u] = u;
+        uniqB_[mapA && mapB ? mapB[u] : u] = u;
+      }
+    });
+    pioParallelFor(nBlocks, options_.nThreads, [&](int64_t blk) {
+      const int64_t start = blk * blockSize;
+      const int64_t end = std::min(nCell, start + blockSize);
+      for (int64_t i = start; i < end; i++)
+        other_[i] = mapA && mapB ? mapB[uniqA_[i]] : i;
+      // sorted_ holds (other cell, position in block) pairs packed as
+      // other * blockSize + position, which sort by other cell
+      for (int64_t i = start; i < end; i++)
+        sorted_[i] = other_[i] * blockSize + (i - start);
+      std::sort(sorted_.begin() + start, sorted_.begin() + end);
+    });
+  }
+
+  /** Adds the comparison of a and b to r, recording cell if they differ **/
+  void compare(PioArrayDiff &r, double a, double b, int64_t cell,
+               int64_t other, int mat) const {
+    r.compared++;
+    if (a == b || (std::isnan(a) && std::isnan(b)))
+      return;
+    const double absErr = std::fabs(a - b);
+    const double relErr = absErr / std::max(std::fabs(a), std::fabs(b));
+    const uint64_t ulp = ulpDistance(a, b);
+    if (!std::isnan(absErr)) {
+      r.maxAbs = std::max(r.maxAbs, absErr);
+      r.maxRel = std::max(r.maxRel, relErr);
+    } else {
+      r.maxAbs = r.maxRel = HUGE_VAL;
+    }
+    r.maxUlp = std::max(r.maxUlp, ulp);
+    if (absErr <= options_.absTol || relErr <= options_.relTol ||
+        ulp <= options_.ulpTol)
+      return;
+    r.differing++;
+    if (int(r.first.size()) < options_.maxReport)
+      r.first.push_back({cell, other, mat, a, b});
+  }
+
+  /** Number of doubles between a and b, the maximum if either is NaN **/
+  static uint64_t ulpDistance(double a, double b) {
+    if (std::isnan(a) || std::isnan(b))
+      return ~0ull;
+    // map the bits to unsigned integers in the order of the doubles
+    auto ordered = [](double x) {
+      uint64_t u;
+      memcpy(&u, &x, sizeof(u));
+      return (u >> 63) ? ~u : u | (1ull << 63);
+    };
+    const uint64_t x = ordered(a), y = ordered(b);
+    return x > y ? x - y : y - x;
+  }
+
+  /** Reads block blk of cell array r.name in the first dump and the
+   *  matching cells of the second into buf.a and buf.b.  Returns the
+   *  number of cells, 0 if a read comes up short.
+   **/
+  int64_t readCells(const std::string &name, int64_t blk, Buffers &buf) {
+    const int64_t blockSize = options_.blockSize;
+    const int64_t start = blk * blockSize;
+    const int64_t n = std::min(blockSize, a_.nCell() - start);
+    buf.a.resize(n);
+    buf.b.resize(n);
+    buf.index.resize(n);
+    if (a_.pio().readArrayRangeInto(name, start, n, buf.a.data()) != n)
+      return 0;
+    for (int64_t j = 0; j < n; j++)
+      buf.index[j] = sorted_[start + j] / blockSize;
+    buf.gathered = b_.pio().readArrayGather(name, buf.index);
+    if (int64_t(buf.gathered.size()) != n)
+      return 0;
+    for (int64_t j = 0; j < n; j++)
+      buf.b[sorted_[start + j] % blockSize] = buf.gathered[j];
+    return n;
+  }
+
+  void compareCells(PioArrayDiff &r, int64_t blk, bool isDaughter,
+                    Buffers &buf) {
+    const int64_t start = blk * options_.blockSize;
+    const int64_t n = readCells(r.name, blk, buf);
+    if (n == 0) {
+      r.unread += std::min(options_.blockSize, a_.nCell() - start);
+      return;
+    }
+    for (int64_t j = 0; j < n; j++) {
+      double a = buf.a[j], b = buf.b[j];
+      if (isDaughter) {
+        // daughters are 1-based cell indices, compare their unique ids
+        a = uniqDaughter(a, uniqA_);
+        b = uniqDaughter(b, uniqB_);
+      }
+      compare(r, a, b, start + j, other_[start + j], 0);
+    }
+  }
+
+  static double uniqDaughter(double d, const std::vector<int64_t> &uniq) {
+    const int64_t i = int64_t(d) - 1;
+    if (d <= 0.0 || i >= int64_t(uniq.size()))
+      return d;
+    return double(uniq[i] + 1);
+  }
+
+  void compareMaterials(PioArrayDiff &r, int64_t blk, Buffers &buf) {
+    const int64_t blockSize = options_.blockSize;
+    const int64_t start = blk * blockSize;
+    const int64_t n = std::min(blockSize, a_.nCell() - start);
+    const std::vector<int64_t> &startA = a_.matStartIndex();
+    const std::vector<int64_t> &startB = b_.matStartIndex();
+    const std::vector<int> &matA = a_.matIds(), &matB = b_.matIds();
+
+    // entries of the block in the first dump, one read
+    const int64_t k0 = startA[start];
+    buf.a.resize(startA[start + n] - k0);
+    if (a_.pio().readArrayRangeInto(r.name, k0, buf.a.size(), buf.a.data()) !=
+        int64_t(buf.a.size())) {
+      r.unread += buf.a.size();
+      return;
+    }
+
+    // entries of the matching cells of the second dump, in ascending
+    // order, and where each cell starts in buf.b
+    std::vector<int64_t> offset(n);
+    buf.index.clear();
+    for (int64_t j = 0; j < n; j++) {
+      const int64_t c = sorted_[start + j] / blockSize;
+      offset[sorted_[start + j] % blockSize] = buf.index.size();
+      for (int64_t k = startB[c]; k < startB[c + 1]; k++)
+        buf.index.push_back(k);
+    }
+    buf.b = b_.pio().readArrayGather(r.name, buf.index);
+    if (buf.b.size() != buf.index.size()) {
+      r.unread += buf.a.size();
+      return;
+    }
+
+    for (int64_t j = 0; j < n; j++) {
+      const int64_t ca = start + j, cb = other_[ca];
+      const int64_t nA = startA[ca + 1] - startA[ca];
+      const int64_t nB = startB[cb + 1] - startB[cb];
+      const int *idA = &matA[startA[ca]], *idB = &matB[startB[cb]];
+      const double *va = &buf.a[startA[ca] - k0], *vb = &buf.b[offset[j]];
+      // pair entries by material; a material in only one dump is
+      // compared with NaN
+      for (int64_t p = 0; p < nA; p++) {
+        int64_t q = 0;
+        while (q < nB && idB[q] != idA[p])
+          q++;
+        compare(r, va[p], q < nB ? vb[q] : NAN, ca, cb, idA[p]);
+      }
+      for (int64_t q = 0; q < nB; q++) {
+        if (std::find(idA, idA + nA, idB[q]) == idA + nA)
+          compare(r, NAN, vb[q], ca, cb, idB[q]);
+      }
+    }
+  }
+
+  void compareElements(PioArrayDiff &r, int64_t blk, Buffers &buf) {
+    const int64_t start = blk * options_.blockSize;
+    const int64_t n =
+        std::min<int64_t>(options_.blockSize,
+                          a_.pio().arrays.at(r.name).length - start);
+    buf.a.resize(n);
+    buf.b.resize(n);
+    if (a_.pio().readArrayRangeInto(r.name, start, n, buf.a.data()) != n ||
+        b_.pio().readArrayRangeInto(r.name, start, n, buf.b.data()) != n) {
+      r.unread += n;
+      return;
+    }
+    for (int64_t j = 0; j < n; j++)
+      compare(r, buf.a[j], buf.b[j], start + j, start + j, 0);
+  }
+};
+
+#endif
+
+// END
@@ -13,11 +13,15 @@
 // so.
 //========================================================================================
 
+#include <algorithm>
+#include <cmath>
+#include <future>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "pioInterface.hpp"
+#include "pioWriter.hpp"
 
 void PioInterface::listFields(FILE *fp) { //< lists fields in the file
   std::vector<std::string> names = pd->arrayOrder;
@@ -31,6 +35,13 @@ void PioInterface::updateDXyz() {
   const int inbr[3] = {1, 2,
                        4}; /* the already known level 1 neighbor information */
 
+  loadLevel();
+  loadCenter();
+  PIOStats::Scope scope(stats_, "phase", "dXyz");
+  if (verbose_) {
+    std::cout << "updating Dxyz\n";
+  }
+
   dXyz_ = new double *[nLevel_ + 1];
 
   for (int l = 0; l <= nLevel_; l++) {
@@ -59,28 +70,32 @@ void PioInterface::freeField(const char *name) {
 }
 
 int64_t PioInterface::getFieldLength(const char *field) {
-  return pd->arrayDims[field].l;
+  auto it = pd->arrayDims.find(field);
+  return it == pd->arrayDims.end() ? 0 : it->second.l;
 }
 
 int64_t PioInterface::getFieldWidth(const char *field) {
-  return pd->arrayDims[field].w;
+  auto it = pd->arrayDims.find(field);
+  return it == pd->arrayDims.end() ? 0 : it->second.w;
 }
 
 template <class T> const T *PioInterface::getUniqMap(const T *field) {
+  const int64_t *map = uniqMap();
   T *fRet = new T[nCell_];
 
   for (int64_t i = 0; i < nCell_; i++)
-    fRet[i] = field[uniqMap_[i]];
+    fRet[i] = field[map[i]];
   return (const T *)fRet;
 }
 
 template <class T>
 const T **PioInterface::getUniqMap(const T **field, const int n) {
+  const int64_t *map = uniqMap();
   T **fRet = new T *[n];
   for (int d = 0; d < n; d++) {
     fRet[d] = new T[nCell_];
     for (int64_t i = 0; i < nCell_; i++) {
-      fRet[d][i] = field[d][uniqMap_[i]];
+      fRet[d][i] = field[d][map[i]];
     }
   }
   return (const T **)fRet;
@@ -99,6 +114,8 @@ void PioInterface::updateIMap() {
   // the number of leaf cells at each of the levels.
 
   int64_t *counts = NULL;
+  loadLevel();
+  loadDaughter();
   iMap = (int64_t **)calloc(nLevel_ + 1, sizeof(int64_t *));
 
   /* compute how many cells at each level */
@@ -150,24 +167,116 @@ PioInterface::~PioInterface() { //< our destructor!
     delete pd;
   if (uniqMap_)
     delete[] uniqMap_;
-  for (int i = 0; i <= nLevel_; i++) {
-    delete[] dXyz_[i];
+  if (dXyz_) {
+    for (int i = 0; i <= nLevel_; i++) {
+      delete[] dXyz_[i];
+    }
+    delete[] dXyz_;
   }
-  delete[] dXyz_;
   if (iMap)
     releaseMapByLevel();
 }
 
-static int i2Compare(const void *va, const void *vb) {
-  const i2_t *a = (const i2_t *)va;
-  const i2_t *b = (const i2_t *)vb;
-  if (a->id < b->id)
-    return -1;
-  else if (a->id == b->id)
-    return 0;
-  return 1;
+namespace {
+/** Morton key of a cell (hi holds the high-order interleaved bits)
+ *  and the cell's index in the dump.
+ **/
+struct uniqKey_t {
+  uint64_t hi;
+  uint64_t lo;
+  int64_t index;
+};
+
+/** spreads the low 32 bits of x so that there is one zero bit
+ *  between consecutive bits
+ **/
+inline uint64_t spreadBits2(uint64_t x) {
+  x &= 0xffffffffull;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | (x << 2)) & 0x3333333333333333ull;
+  x = (x | (x << 1)) & 0x5555555555555555ull;
+  return x;
 }
-#define mymax(a, b) ((a) > (b) ? (a) : (b))
+
+/** spreads the low 21 bits of x so that there are two zero bits
+ *  between consecutive bits
+ **/
+inline uint64_t spreadBits3(uint64_t x) {
+  x &= 0x1fffffull;
+  x = (x | (x << 32)) & 0x001f00000000ffffull;
+  x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+  x = (x | (x << 8)) & 0x100f00f00f00f00full;
+  x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+  x = (x | (x << 2)) & 0x1249249249249249ull;
+  return x;
+}
+
+/** Stable parallel LSD radix sort of keys on (hi, lo), one byte per
+ *  pass.  Passes over bytes that are the same for every key are
+ *  skipped, so small meshes only pay for the bytes actually used.
+ **/
+void radixSortKeys(std::vector<uniqKey_t> &keys, int nThreads) {
+  const int64_t n = keys.size();
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  const int64_t nChunks =
+      std::max<int64_t>(1, std::min<int64_t>(nThreads, n / 65536));
+  const int64_t chunkSize = (n + nChunks - 1) / nChunks;
+  auto digit = [](const uniqKey_t &k, int pass) -> unsigned {
+    return pass < 8 ? (k.lo >> (8 * pass)) & 0xff
+                    : (k.hi >> (8 * (pass - 8))) & 0xff;
+  };
+
+  // find the passes that actually need doing
+  uint64_t orLo = 0, andLo = ~0ull, orHi = 0, andHi = ~0ull;
+  for (auto &k : keys) {
+    orLo |= k.lo;
+    andLo &= k.lo;
+    orHi |= k.hi;
+    andHi &= k.hi;
+  }
+  const uint64_t varyLo = orLo ^ andLo, varyHi = orHi ^ andHi;
+
+  std::vector<uniqKey_t> tmp(n);
+  std::vector<int64_t> counts(nChunks * 256);
+  for (int pass = 0; pass < 16; pass++) {
+    uint64_t vary =
+        pass < 8 ? varyLo >> (8 * pass) : varyHi >> (8 * (pass - 8));
+    if (!(vary & 0xff))
+      continue;
+
+    // histogram of each chunk
+    std::fill(counts.begin(), counts.end(), 0);
+    pioParallelFor(nChunks, nThreads, [&](int64_t c) {
+      int64_t *cnt = &counts[c * 256];
+      const int64_t end = std::min(n, (c + 1) * chunkSize);
+      for (int64_t i = c * chunkSize; i < end; i++)
+        cnt[digit(keys[i], pass)]++;
+    });
+
+    // exclusive scan in (digit, chunk) order keeps the sort stable
+    int64_t sum = 0;
+    for (int b = 0; b < 256; b++) {
+      for (int64_t c = 0; c < nChunks; c++) {
+        int64_t x = counts[c * 256 + b];
+        counts[c * 256 + b] = sum;
+        sum += x;
+      }
+    }
+
+    pioParallelFor(nChunks, nThreads, [&](int64_t c) {
+      int64_t *offset = &counts[c * 256];
+      const int64_t end = std::min(n, (c + 1) * chunkSize);
+      for (int64_t i = c * chunkSize; i < end; i++)
+        tmp[offset[digit(keys[i], pass)]++] = keys[i];
+    });
+    keys.swap(tmp);
+  }
+}
+} // namespace
+
 void PioInterface::updateUniqMap() {
   /**<
    * generates a unique id for each cell so that we can directly
@@ -175,105 +284,351 @@ void PioInterface::updateUniqMap() {
    * numbers of processors.
    *
    * Here is how it is done:
-   * 1: divide each coordinate by the dXyz of the finest level
-   * 2: find Nx,Ny,and Nz as the highest index in x,y,and z directions
-   * 3: id = (x/dx) + Nx*(y/dy) + Nx*Ny*(z/dz)
-   * 4: sort the IDs to get the map so that uniq[i] = id of cell that
-   *    is the ith cell in this mapping
+   * 1: measure each center from the lowest center in units of the
+   *    finest level dXyz (a half cell width), which makes every
+   *    center an integer
+   * 2: interleave the bits of the integer coordinates into a Morton
+   *    (Z-order) key, up to 64 bits per dimension in 2D and 42 in 3D
+   * 3: radix sort the keys to get the map so that uniq[i] = id of
+   *    cell that is the ith cell in this mapping
    *
-   * I'm sure there's a better way to do this, but this will have to
-   * do for now
+   * Coordinates and keys are computed in parallel over blocks of
+   * cells and the sort is a parallel LSD radix sort.
    **/
+  loadLevel();
+  loadCenter();
+  loadDXyz();
+  PIOStats::Scope scope(stats_, "phase", "uniqMap");
 
-  /** allocate temporary space for our IDs **/
-  i2_t *i2 = new i2_t[nCell_];
-  int64_t nMax[nDim_];
+  const int nDim = std::min(nDim_, 3);
   const double *dxyz = dXyz_[nLevel_];
-  const double scale = (double)(((int64_t)1) << nLevel_);
-  int64_t(*idxyz)[3] = new int64_t[nCell_][3];
-  //  for(int d=0; d<nDim_; d++) idxyz[d] = new int64_t [nCell_];
-
-  /* zero out the Nxyz */
-  memset(nMax, 0, sizeof(nMax));
-
-  /* compute coordinates and max of dimensions */
-  for (int d = 0; d < nDim_; d++) {
-    for (int64_t i = 0; i < nCell_; i++) {
-      idxyz[i][d] = (int64_t)floor((scale * center_[d][i] / dxyz[d] + 0.5));
-      nMax[d] = mymax(nMax[d], idxyz[i][d]);
-    }
+  const int64_t blockSize = 1 << 16;
+  const int64_t nBlocks = (nCell_ + blockSize - 1) / blockSize;
+  auto blockEnd = [&](int64_t b) {
+    return std::min(nCell_, (b + 1) * blockSize);
+  };
+
+  /* lowest center in each dimension */
+  double cMin[3] = {0.0, 0.0, 0.0};
+  for (int d = 0; d < nDim; d++) {
+    std::vector<double> blockMin(nBlocks, HUGE_VAL);
+    const double *c = center_[d].data();
+    pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+      double m = HUGE_VAL;
+      for (int64_t i = b * blockSize; i < blockEnd(b); i++)
+        m = std::min(m, c[i]);
+      blockMin[b] = m;
+    });
+    cMin[d] = *std::min_element(blockMin.begin(), blockMin.end());
   }
 
-  /* compute the temporary ID and fill in index */
-  for (int64_t i = 0; i < nCell_; i++) {
-    i2[i].index = i;
-    i2[i].id = idxyz[i][0];
-    if (nDim_ > 1)
-      i2[i].id += nMax[0] * idxyz[i][1]; // 2d?
-    if (nDim_ > 1)
-      i2[i].id += nMax[0] * nMax[1] * idxyz[i][2]; // 3d?
+  /* integer coordinates and Morton keys */
+  std::vector<uniqKey_t> keys(nCell_);
+  std::vector<uint64_t> blockMax(nBlocks, 0);
+  pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+    uint64_t q[3] = {0, 0, 0};
+    uint64_t qMax = 0;
+    for (int64_t i = b * blockSize; i < blockEnd(b); i++) {
+      for (int d = 0; d < nDim; d++) {
+        q[d] = (uint64_t)floor((center_[d][i] - cMin[d]) / dxyz[d] + 0.5);
+        qMax |= q[d];
+      }
+      auto &k = keys[i];
+      k.index = i;
+      if (nDim == 1) {
+        k.hi = 0;
+        k.lo = q[0];
+      } else if (nDim == 2) {
+        k.lo = spreadBits2(q[0]) | (spreadBits2(q[1]) << 1);
+        k.hi = spreadBits2(q[0] >> 32) | (spreadBits2(q[1] >> 32) << 1);
+      } else {
+        k.lo = spreadBits3(q[0]) | (spreadBits3(q[1]) << 1) |
+               (spreadBits3(q[2]) << 2);
+        k.hi = spreadBits3(q[0] >> 21) | (spreadBits3(q[1] >> 21) << 1) |
+               (spreadBits3(q[2] >> 21) << 2);
+      }
+    }
+    blockMax[b] = qMax;
+  });
+  if (nDim == 3) {
+    uint64_t qMax = 0;
+    for (auto m : blockMax)
+      qMax |= m;
+    if (qMax >> 42) {
+      std::cerr << "updateUniqMap: mesh is too deep for 42 bit coordinates, "
+                << "unique ids may collide\n";
+    }
   }
 
-  qsort((void *)i2, nCell_, sizeof(i2_t), i2Compare);
+  radixSortKeys(keys, nThreads_);
 
   /** allocate a unique map **/
   uniqMap_ = new int64_t[nCell_];
-  for (int64_t i = 0; i < nCell_; i++)
-    uniqMap_[i] = i2[i].index;
+  pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+    for (int64_t i = b * blockSize; i < blockEnd(b); i++)
+      uniqMap_[i] = keys[i].index;
+  });
+  return;
+}
 
-  /** free data **/
-  delete[] i2;
-  //  for(int d=0; d<nDim_; d++) delete[] idxyz[d];
-  delete[] idxyz;
+/** Header of a saved unique map; the nCell map entries follow it **/
+struct uniqMapFileHeader_t {
+  char magic[8];
+  int64_t nCell;
+  uint64_t checksum;    //< index checksum of the dump the map was built for
+  uint64_t fingerprint; //< hash of a sample of the cell centers
+};
+
+uint64_t PioInterface::centerFingerprint() {
+  // a strided sample of the centers tells apart dumps that share an
+  // index layout but not a cell ordering, without reading the centers
+  uint64_t hash = 14695981039346656037ull;
+  const int64_t nSample = 4096;
+  const int64_t stride = std::max<int64_t>(1, nCell_ / nSample);
+  for (int d = 1; d <= nDim_; d++) {
+    auto sample = pd->readArrayStrided("cell_center_" + std::to_string(d), 0,
+                                       nSample, stride);
+    const unsigned char *c = (const unsigned char *)sample.data();
+    for (size_t i = 0; i < sample.size() * sizeof(double); i++)
+      hash = (hash ^ c[i]) * 1099511628211ull;
+  }
+  return hash;
+}
 
-  return;
+int PioInterface::writeUniqMap(const char *filename) {
+  const int64_t *map = uniqMap();
+  if (!map)
+    return 1;
+  uniqMapFileHeader_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "piouniq1", 8);
+  h.nCell = nCell_;
+  h.checksum = pd->index()->checksum;
+  h.fingerprint = centerFingerprint();
+  FILE *fp = fopen(filename, "wb");
+  if (!fp)
+    return 1;
+  bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+            fwrite(map, sizeof(int64_t), nCell_, fp) == (size_t)nCell_;
+  ok = (fclose(fp) == 0) && ok;
+  return ok ? 0 : 1;
+}
+
+int PioInterface::readUniqMap(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return 1;
+  uniqMapFileHeader_t h;
+  int64_t *map = nullptr;
+  if (fread(&h, sizeof(h), 1, fp) == 1 && !memcmp(h.magic, "piouniq1", 8) &&
+      h.nCell == nCell_ && h.checksum == pd->index()->checksum &&
+      h.fingerprint == centerFingerprint()) {
+    map = new int64_t[nCell_];
+    if (fread(map, sizeof(int64_t), nCell_, fp) != (size_t)nCell_) {
+      delete[] map;
+      map = nullptr;
+    }
+  }
+  fclose(fp);
+  if (!map)
+    return 1;
+
+  // only install the map if none has been computed yet
+  bool used = false;
+  std::call_once(uniqOnce_, [&]() {
+    uniqMap_ = map;
+    used = true;
+  });
+  if (!used)
+    delete[] map;
+  uniq_ = 1;
+  return 0;
+}
+
+double PioMaterialView::value(int64_t icell, int mat) const {
+  for (int64_t k = (*matStartIndex_)[icell]; k < (*matStartIndex_)[icell + 1];
+       k++) {
+    if ((*matIds_)[k] == mat)
+      return data_[k];
+  }
+  return 0.0;
+}
+
+void PioMaterialView::buildMaterialIndex() {
+  // counting sort of the CSR entries by material id
+  const int64_t csrLength = (*matStartIndex_)[nCell_];
+  byMatStart_.assign(nMat_ + 1, 0);
+  for (int64_t k = 0; k < csrLength; k++) {
+    int idMat = (*matIds_)[k];
+    if (idMat >= 1 && idMat <= nMat_)
+      byMatStart_[idMat]++;
+  }
+  for (int m = 1; m <= nMat_; m++)
+    byMatStart_[m] += byMatStart_[m - 1];
+
+  std::vector<int64_t> next(byMatStart_.begin(), byMatStart_.end() - 1);
+  byMatEntry_.resize(byMatStart_[nMat_]);
+  byMatCell_.resize(byMatStart_[nMat_]);
+  for (int64_t icell = 0; icell < nCell_; icell++) {
+    for (int64_t k = (*matStartIndex_)[icell];
+         k < (*matStartIndex_)[icell + 1]; k++) {
+      int idMat = (*matIds_)[k];
+      if (idMat < 1 || idMat > nMat_)
+        continue;
+      int64_t j = next[idMat - 1]++;
+      byMatEntry_[j] = k;
+      byMatCell_[j] = icell;
+    }
+  }
 }
 
 std::map<int, std::vector<double>>
-PioInterface::getMaterialVariable(const char *field) {
+PioMaterialView::dense(const std::vector<int> &mats) const {
   std::map<int, std::vector<double>> rMap;
+  if (empty())
+    return rMap;
+
+  // slot[idMat] is the output array for material idMat, or null
+  std::vector<double *> slot(nMat_ + 1, nullptr);
+  for (int i = 1; i <= nMat_; i++) {
+    if (mats.empty() || std::find(mats.begin(), mats.end(), i) != mats.end()) {
+      rMap[i] = std::vector<double>(nCell_, 0.0);
+      slot[i] = rMap[i].data();
+    }
+  }
+
+  // cells are independent, so blocks of cells can be filled in parallel
+  const int64_t blockSize = 1 << 16;
+  const int64_t nBlocks = (nCell_ + blockSize - 1) / blockSize;
+  pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+    const int64_t end = std::min(nCell_, (b + 1) * blockSize);
+    for (int64_t icell = b * blockSize; icell < end; icell++) {
+      for (int64_t k = (*matStartIndex_)[icell];
+           k < (*matStartIndex_)[icell + 1]; k++) {
+        int idMat = (*matIds_)[k];
+        if (idMat >= 1 && idMat <= nMat_ && slot[idMat])
+          slot[idMat][icell] = data_[k];
+      }
+    }
+  });
+  return rMap;
+}
+
+void PioMaterialView::expand(int mat, double *out,
+                             const double *scale) const {
+  const int64_t blockSize = 1 << 16;
+  const int64_t nBlocks = (nCell_ + blockSize - 1) / blockSize;
+  if (byMatStart_.empty()) {
+    pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+      const int64_t end = std::min(nCell_, (b + 1) * blockSize);
+      for (int64_t icell = b * blockSize; icell < end; icell++) {
+        double v = 0.0;
+        for (int64_t k = (*matStartIndex_)[icell];
+             k < (*matStartIndex_)[icell + 1]; k++) {
+          if ((*matIds_)[k] == mat)
+            v = data_[k];
+        }
+        out[icell] = scale ? v * scale[icell] : v;
+      }
+    });
+    return;
+  }
+
+  pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+    const int64_t end = std::min(nCell_, (b + 1) * blockSize);
+    std::fill(out + b * blockSize, out + end, 0.0);
+  });
+  if (mat < 1 || mat > nMat_)
+    return;
+  const int64_t first = byMatStart_[mat - 1];
+  const int64_t n = byMatStart_[mat] - first;
+  pioParallelFor((n + blockSize - 1) / blockSize, nThreads_, [&](int64_t b) {
+    const int64_t end = first + std::min(n, (b + 1) * blockSize);
+    for (int64_t j = first + b * blockSize; j < end; j++) {
+      const int64_t icell = byMatCell_[j];
+      const double v = data_[byMatEntry_[j]];
+      out[icell] = scale ? v * scale[icell] : v;
+    }
+  });
+}
+
+PioMaterialView PioInterface::getMaterialView(const char *field) {
   auto data = getField<double>(field);
   if (data.size() == 0) {
-    if (verbose_) {
-      std::cout << "Unable to find Field: " << field << std::endl;
-    }
     if (!strncmp("chunk_", field, 6)) {
-      char newField[strlen(field) + 1];
-      sprintf(newField, "frac_%s_0", field + 6);
+      std::string newField = std::string("frac_") + (field + 6);
       if (verbose_) {
         std::cout << "Unable to find Field: " << field << " trying " << newField
                   << std::endl;
       }
-      return getMaterialVariable(newField);
+      return getMaterialView(newField.c_str());
     } else {
       if (verbose_) {
         std::cout << "Unable to find Field: " << field << std::endl;
       }
-      return rMap;
+      return PioMaterialView();
     }
   }
   if (verbose_) {
     std::cout << "Found Field: " << field << std::endl;
   }
-
-  // allocate space for variables
-  for (int i = 1; i <= nMat(); i++) {
-    rMap[i] = std::vector<double>(nCell_, 0.0);
+  loadMaterials();
+  if (data.size() != matIds_.size()) {
+    if (verbose_) {
+      std::cout << "Field " << field << " has " << data.size()
+                << " values for " << matIds_.size() << " material entries"
+                << std::endl;
+    }
+    return PioMaterialView();
   }
+  return PioMaterialView(std::move(data), matIds_, matStartIndex_, nMat_,
+                         nThreads_);
+}
 
-  if (nMat() == 1) {
-    memcpy(rMap[1].data(), data.data(), nCell_ * sizeof(double));
-    return rMap;
-  }
+PIOArrayCache::Array PioInterface::getSharedField(const char *field,
+                                                  int index) {
+  std::string name = std::string(field) + "_" + std::to_string(index);
+  if (!cache_ || !pd->arrays.count(name))
+    return std::make_shared<const std::vector<double>>(pd->readArray(name));
+  return cache_->get(cachePrefix_ + name,
+                     [&]() { return pd->readArray(name); });
+}
 
-  // cycle through cells and fill in fields
-  for (int64_t icell = 0; icell < nCell_; icell++) {
-    for (int64_t indexMat = matStartIndex_[icell];
-         indexMat < matStartIndex_[icell + 1]; indexMat++) {
-      int idMat = matIds_[indexMat];
-      rMap[idMat][icell] = data[indexMat];
+std::vector<std::shared_ptr<double>>
+PioInterface::getDChunkField(const char *field) {
+  // dense arrays are cached as <field>#<mat>, next to the CSR arrays
+  std::vector<PIOArrayCache::Array> dense(nMat_);
+  std::vector<int> missing;
+  for (int m = 1; m <= nMat_; m++) {
+    if (cache_)
+      dense[m - 1] =
+          cache_->find(cachePrefix_ + field + "#" + std::to_string(m));
+    if (!dense[m - 1])
+      missing.push_back(m);
+  }
+  if (!missing.empty()) {
+    PioMaterialView view = getMaterialView(field);
+    if (view.empty())
+      return std::vector<std::shared_ptr<double>>();
+    for (int m : missing) {
+      std::vector<double> d(nCell_);
+      view.expand(m, d.data());
+      const std::string key = cachePrefix_ + field + "#" + std::to_string(m);
+      dense[m - 1] =
+          cache_ ? cache_->insert(key, std::move(d))
+                 : std::make_shared<const std::vector<double>>(std::move(d));
     }
   }
+  // the returned pointers share ownership of the vectors
+  std::vector<std::shared_ptr<double>> result;
+  for (auto &d : dense)
+    result.emplace_back(d, const_cast<double *>(d->data()));
+  return result;
+}
+
+std::map<int, std::vector<double>>
+PioInterface::getMaterialVariable(const char *field) {
+  auto rMap = getMaterialView(field).dense();
   if (verbose_) {
     std::cout << "Done generating map" << std::endl;
   }
@@ -281,62 +636,181 @@ PioInterface::getMaterialVariable(const char *field) {
   return rMap;
 }
 
-// initializer takes dump file name and request for unique ids
-PioInterface::PioInterface(const char *name, const int uniq, const int verbose)
-    : uniqMap_(nullptr), dXyz_(nullptr), iMap(nullptr), verbose_(verbose) {
-  // initializes a class from file name and request for unique map
-  try {
-    uniq_ = uniq;
-    if (verbose) {
-      std::cout << "getting piodata\n";
+int PioInterface::expandMaterialVariables(PioWriter &out,
+                                          std::vector<std::string> fields,
+                                          bool scale, std::vector<int> mats) {
+  if (!out.good())
+    return 1;
+  loadMaterials();
+  const int64_t csrLength = matIds_.size();
+  if (fields.empty()) {
+    for (auto &name : pd->arrayOrder) {
+      auto it = pd->arrays.find(name);
+      if (it != pd->arrays.end() && it->second.index == 0 &&
+          static_cast<int64_t>(it->second.length) == csrLength &&
+          name.size() > 2 && !name.compare(name.size() - 2, 2, "_0"))
+        fields.push_back(name.substr(0, name.size() - 2));
     }
-    pd = new PIO(name);
-
-    nDim_ = pd->ndim();
-    nCell_ = pd->numcell();
+  }
+  if (mats.empty()) {
+    for (int i = 1; i <= nMat_; i++)
+      mats.push_back(i);
+  }
 
-    if (verbose) {
-      std::cout << "getting levels\n";
+  std::vector<double> invVolume;
+  if (scale) {
+    invVolume = getInverseVolume();
+    if (invVolume.empty()) {
+      std::cout << "Unable to find Field: vcell" << std::endl;
+      return 1;
     }
-    level_ = getField<int>("cell_level");
-    updateNLevel(); // Note this requires the level array to be gathered first
+  }
 
-    if (verbose) {
-      std::cout << "getting centers\n";
+  // expand into one buffer while the other one is being written
+  std::vector<double> buffer[2] = {std::vector<double>(nCell_),
+                                   std::vector<double>(nCell_)};
+  std::future<bool> pending;
+  int k = 0;
+  bool ok = true;
+  for (auto &field : fields) {
+    PioMaterialView view = getMaterialView(field.c_str());
+    if (view.empty()) {
+      ok = false;
+      break;
     }
-    center_ = getField2D<double>("cell_center");
-
-    if (verbose) {
-      std::cout << "getting daughters\n";
+    view.buildMaterialIndex();
+    for (int mat : mats) {
+      std::vector<double> &b = buffer[k++ & 1];
+      view.expand(mat, b.data(), scale ? invVolume.data() : nullptr);
+      if (pending.valid() && !pending.get()) {
+        ok = false;
+        break;
+      }
+      std::string name = field + "-" + std::to_string(mat);
+      pending = std::async(std::launch::async, [&out, &b, name]() {
+        return out.appendArray(name, b.data(), b.size());
+      });
     }
-    daughter_ = getField<int64_t>("cell_daughter");
+    if (!ok)
+      break;
+  }
+  if (pending.valid())
+    ok = pending.get() && ok;
+  return ok ? 0 : 1;
+}
 
-    // Get material variable information
-    if (verbose) {
-      std::cout << "updating material information\n";
-    }
-    nMat_ = getFieldWidth("matdef");
-    matIds_ = getField<int>("chunk_mat");
-    matStartIndex_ = getField<int64_t>("chunk_nummat");
-    matStartIndex_.resize(nCell_ + 1);
-    {
-      // Shift the start indices
-      int64_t startIdx;
-      startIdx = 0;
-      for (int64_t i = 0; i < nCell_; i++) {
-        int64_t n = matStartIndex_[i];
-        matStartIndex_[i] = startIdx;
-        startIdx += n;
-      }
-      matStartIndex_[nCell_] = startIdx;
+std::vector<double> PioInterface::getInverseVolume() {
+  std::vector<double> invVolume = getField<double>("vcell");
+  if (static_cast<int64_t>(invVolume.size()) != nCell_)
+    return std::vector<double>();
+  const int64_t blockSize = 1 << 16;
+  const int64_t nBlocks = (nCell_ + blockSize - 1) / blockSize;
+  pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+    const int64_t end = std::min(nCell_, (b + 1) * blockSize);
+    for (int64_t i = b * blockSize; i < end; i++)
+      invVolume[i] = invVolume[i] != 0.0 ? 1.0 / invVolume[i] : 0.0;
+  });
+  return invVolume;
+}
+
+void PioInterface::updateLevel() {
+  PIOStats::Scope scope(stats_, "phase", "levels");
+  if (verbose_) {
+    std::cout << "getting levels\n";
+  }
+  level_ = getField<int>("cell_level");
+  updateNLevel(); // Note this requires the level array to be gathered first
+}
+
+void PioInterface::updateCenter() {
+  PIOStats::Scope scope(stats_, "phase", "centers");
+  if (verbose_) {
+    std::cout << "getting centers\n";
+  }
+  // read into a local vector so that no thread touches the map
+  std::vector<std::vector<double>> center(nDim_);
+  pioParallelFor(nDim_, nThreads_, [&](int64_t d) {
+    center[d] = getField<double>("cell_center", d + 1);
+  });
+  for (int d = 0; d < nDim_; d++)
+    center_[d] = std::move(center[d]);
+}
+
+void PioInterface::updateDaughter() {
+  PIOStats::Scope scope(stats_, "phase", "daughters");
+  if (verbose_) {
+    std::cout << "getting daughters\n";
+  }
+  daughter_ = getField<int64_t>("cell_daughter");
+}
+
+void PioInterface::updateMaterials() {
+  PIOStats::Scope scope(stats_, "phase", "materials");
+  // Get material variable information
+  if (verbose_) {
+    std::cout << "updating material information\n";
+  }
+  pioParallelFor(2, nThreads_, [&](int64_t i) {
+    if (i == 0)
+      matIds_ = getField<int>("chunk_mat");
+    else
+      matStartIndex_ = getField<int64_t>("chunk_nummat");
+  });
+  if (nMat_ == 1 && matIds_.empty()) {
+    // single-material dumps may have no CSR arrays: every cell holds
+    // material 1 and material variables are cell arrays
+    matIds_.assign(nCell_, 1);
+    matStartIndex_.assign(nCell_, 1);
+  }
+  matStartIndex_.resize(nCell_ + 1);
+  {
+    // Shift the start indices
+    int64_t startIdx;
+    startIdx = 0;
+    for (int64_t i = 0; i < nCell_; i++) {
+      int64_t n = matStartIndex_[i];
+      matStartIndex_[i] = startIdx;
+      startIdx += n;
     }
+    matStartIndex_[nCell_] = startIdx;
+  }
+}
+
+void PioInterface::loadMesh() {
+  // The mesh arrays are independent, so read them concurrently
+  std::function<void()> loads[] = {[&]() { loadLevel(); },
+                                   [&]() { loadCenter(); },
+                                   [&]() { loadDaughter(); },
+                                   [&]() { loadMaterials(); }};
+  pioParallelFor(4, nThreads_, [&](int64_t i) { loads[i](); });
+  loadDXyz();
+  if (uniq_)
+    loadUniqMap();
+}
 
+// initializer takes dump file name and request for unique ids
+PioInterface::PioInterface(const char *name, const int uniq, const int verbose,
+                           const int nThreads, PIOStats *stats)
+    : nLevel_(0), uniqMap_(nullptr), dXyz_(nullptr), iMap(nullptr),
+      verbose_(verbose), nThreads_(nThreads), stats_(stats),
+      cache_(nullptr) {
+  // initializes a class from file name and request for unique map.
+  // Only the index is read here, mesh data is read when first used.
+  try {
+    uniq_ = uniq;
     if (verbose) {
-      std::cout << "updating Dxyz\n";
+      std::cout << "getting piodata\n";
     }
-    updateDXyz();
-    if (uniq)
-      updateUniqMap();
+    pd = new PIO(name, false, false, nullptr, stats);
+
+    nDim_ = pd->ndim();
+    nCell_ = pd->numcell();
+    nMat_ = getFieldWidth("matdef");
+    // the same file with the same layout shares cache entries
+    char checksum[20];
+    snprintf(checksum, sizeof(checksum), "%016llx",
+             (unsigned long long)pd->index()->checksum);
+    cachePrefix_ = std::string(name) + "@" + checksum + ":";
     if (verbose) {
       std::cout << "done\n";
     }
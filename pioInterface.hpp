@@ -16,21 +16,104 @@
 #ifndef EXAMPLE_AMHC_PIOINTERFACE_HPP_
 #define EXAMPLE_AMHC_PIOINTERFACE_HPP_
 
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <math.h>
 #include <unistd.h>
 
 #include "pio.hpp"
+#include "pioCache.hpp"
+
+class PioWriter;
 
 typedef struct i2_t {
   int64_t id;
   int64_t index;
 } i2_t;
 
+/** Sparse view of a material (chunk_) variable.  Values stay in the
+ *  compressed sparse row layout of the dump: the values of cell i are
+ *  data()[matStartIndex[i] .. matStartIndex[i+1]) and belong to the
+ *  materials matIds[...] at the same positions.  The CSR arrays are
+ *  borrowed from the PioInterface that created the view and must
+ *  outlive it.
+ **/
+class PioMaterialView {
+public:
+  PioMaterialView() : matIds_(nullptr), matStartIndex_(nullptr), nCell_(0) {}
+  PioMaterialView(std::vector<double> data, const std::vector<int> &matIds,
+                  const std::vector<int64_t> &matStartIndex, int nMat,
+                  int nThreads = 0)
+      : data_(std::move(data)), matIds_(&matIds),
+        matStartIndex_(&matStartIndex), nCell_(matStartIndex.size() - 1),
+        nMat_(nMat), nThreads_(nThreads) {}
+
+  bool empty() const { return data_.empty(); }
+  int64_t nCell() const { return nCell_; }
+  int nMat() const { return nMat_; }
+  const std::vector<double> &data() const { return data_; }
+
+  /** calls f(matId, value) for every material present in cell icell **/
+  template <typename F> void forEachInCell(int64_t icell, F f) const {
+    for (int64_t k = (*matStartIndex_)[icell]; k < (*matStartIndex_)[icell + 1];
+         k++)
+      f((*matIds_)[k], data_[k]);
+  }
+
+  /** calls f(icell, value) for every cell that contains material mat,
+   *  in cell order.  Uses the per-material index if it has been built
+   *  with buildMaterialIndex(), otherwise scans all cells.
+   **/
+  template <typename F> void forEachInMaterial(int mat, F f) const {
+    if (!byMatStart_.empty()) {
+      if (mat < 1 || mat > nMat_)
+        return;
+      for (int64_t j = byMatStart_[mat - 1]; j < byMatStart_[mat]; j++)
+        f(byMatCell_[j], data_[byMatEntry_[j]]);
+      return;
+    }
+    for (int64_t icell = 0; icell < nCell_; icell++) {
+      for (int64_t k = (*matStartIndex_)[icell];
+           k < (*matStartIndex_)[icell + 1]; k++) {
+        if ((*matIds_)[k] == mat)
+          f(icell, data_[k]);
+      }
+    }
+  }
+
+  double value(int64_t icell, int mat) const; //< 0 if mat not in icell
+  void buildMaterialIndex(); //< per-material entry lists [csrLength]
+
+  /** Writes material mat as a dense cell array to out [nCell], each
+   *  value multiplied by scale[icell] if scale is given.  Cells without
+   *  the material are set to 0.  Runs in parallel over cells, or over
+   *  the material's entries once buildMaterialIndex() has been called.
+   **/
+  void expand(int mat, double *out, const double *scale = nullptr) const;
+
+  /** Expands the selected materials (all if mats is empty) to dense
+   *  cell arrays, in parallel over blocks of cells.
+   **/
+  std::map<int, std::vector<double>>
+  dense(const std::vector<int> &mats = std::vector<int>()) const;
+
+private:
+  std::vector<double> data_;
+  const std::vector<int> *matIds_;
+  const std::vector<int64_t> *matStartIndex_;
+  int64_t nCell_;
+  int nMat_ = 0;
+  int nThreads_ = 0;
+  std::vector<int64_t> byMatStart_; //< start of each material in byMatEntry_
+  std::vector<int64_t> byMatEntry_; //< CSR entries grouped by material
+  std::vector<int64_t> byMatCell_;  //< cell of each byMatEntry_
+};
+
 class PioInterface {
 private:
   int uniq_;   //< if set to 1 will provide unique ids across multiple processor
@@ -53,6 +136,14 @@ private:
   std::vector<int64_t>
       matStartIndex_; //< Index at which materials start for each cell
   int verbose_;       //< print verbose information
+  int nThreads_;      //< threads used for reading (0 = all hardware threads)
+  PIOStats *stats_;   //< instrumentation, null if disabled
+  PIOArrayCache *cache_;   //< shared array cache, null if disabled
+  std::string cachePrefix_; //< prepended to array names in cache_ keys
+
+  // mesh data is read on first use; each flag guards one group
+  std::once_flag levelOnce_, centerOnce_, daughterOnce_, matOnce_, dXyzOnce_,
+      uniqOnce_;
 
   // private functions
   void updateIMap();
@@ -60,6 +151,30 @@ private:
   void updateNCell();
   void updateNLevel();
   void updateUniqMap();
+  void updateLevel();
+  void updateCenter();
+  void updateDaughter();
+  void updateMaterials();
+  uint64_t centerFingerprint();
+
+  void loadLevel() {
+    std::call_once(levelOnce_, &PioInterface::updateLevel, this);
+  }
+  void loadCenter() {
+    std::call_once(centerOnce_, &PioInterface::updateCenter, this);
+  }
+  void loadDaughter() {
+    std::call_once(daughterOnce_, &PioInterface::updateDaughter, this);
+  }
+  void loadMaterials() {
+    std::call_once(matOnce_, &PioInterface::updateMaterials, this);
+  }
+  void loadDXyz() {
+    std::call_once(dXyzOnce_, &PioInterface::updateDXyz, this);
+  }
+  void loadUniqMap() {
+    std::call_once(uniqOnce_, &PioInterface::updateUniqMap, this);
+  }
 
   void releaseMapByLevel();
   void freeField(const char *name);
@@ -67,24 +182,68 @@ private:
 public:
   void listFields(FILE *fp); //< prints fields in the dmp file to fp
 
-  /** member access functions **/
+  /** member access functions
+   *  The mesh arrays are read from the dump the first time they are
+   *  asked for; these accessors are safe to call from several threads.
+   **/
   int uniq() { return uniq_; }
   int64_t nCell() { return nCell_; }
   int nDim() { return nDim_; }
 
   int nMat() { return nMat_; }
-  std::vector<int> &matIds() { return matIds_; }
-  std::vector<int64_t> &matStartIndex() { return matStartIndex_; }
+  std::vector<int> &matIds() {
+    loadMaterials();
+    return matIds_;
+  }
+  std::vector<int64_t> &matStartIndex() {
+    loadMaterials();
+    return matStartIndex_;
+  }
 
-  int nLevel() { return nLevel_; }
-  const double **dXyz() { return (const double **)(dXyz_); }
-  const int64_t *uniqMap() { return (const int64_t *)uniqMap_; }
+  int nLevel() {
+    loadLevel();
+    return nLevel_;
+  }
+  const double **dXyz() {
+    loadDXyz();
+    return (const double **)(dXyz_);
+  }
+  const int64_t *uniqMap() {
+    if (uniq_)
+      loadUniqMap();
+    return (const int64_t *)uniqMap_;
+  }
 
-  std::map<int, std::vector<double>> &center() { return center_; }
-  std::vector<int> &level() { return level_; }
-  std::vector<int64_t> &daughter() { return daughter_; }
+  std::map<int, std::vector<double>> &center() {
+    loadCenter();
+    return center_;
+  }
+  std::vector<int> &level() {
+    loadLevel();
+    return level_;
+  }
+  std::vector<int64_t> &daughter() {
+    loadDaughter();
+    return daughter_;
+  }
+
+  void loadMesh(); //< reads all mesh data now, concurrently
 
   std::vector<std::string> getFieldNames();
+  PIO &pio() { return *pd; } //< underlying reader, e.g. for PIOBlockReader
+  PIOStats *stats() { return stats_; }
+
+  /** Arrays are served from cache once it is set (null disables it);
+   *  getSharedField() and getDChunkField() fill it.  The cache may be
+   *  shared with other PioInterface objects.
+   **/
+  void setCache(PIOArrayCache *cache) { cache_ = cache; }
+  PIOArrayCache *cache() { return cache_; }
+
+  /** Shared read-only copy of a field, from the cache if one is set;
+   *  empty if the field does not exist.
+   **/
+  PIOArrayCache::Array getSharedField(const char *field, int index = 0);
 
   int64_t
   getFieldWidth(const char *field); //< Width / Number of instances of a field
@@ -119,12 +278,23 @@ public:
   template <typename T>
   std::vector<T> getVariable(const char *field, int index = 0) {
     // field name *must* exactly match a field in PIO file
-    return pd->variable<T>(field, index);
+    return getField<T>(field, index);
   }
 
+  /** Reads a field as type T.  If the field is in the cache it is
+   *  copied from there; otherwise it is read from the dump in one pass
+   *  and not added to the cache, which would take a second full copy.
+   *  Use getSharedField() to fill the cache and share the buffer.
+   **/
   template <typename T>
   std::vector<T> getField(const char *field, int index = 0) {
-    return pd->variable<T>(field, index);
+    if (!cache_)
+      return pd->variable<T>(field, index);
+    PIOArrayCache::Array data = cache_->find(
+        cachePrefix_ + field + "_" + std::to_string(index));
+    if (!data)
+      return pd->variable<T>(field, index);
+    return std::vector<T>(data->begin(), data->end());
   }
 
   template <typename T>
@@ -132,22 +302,51 @@ public:
     std::map<int, std::vector<T>> data;
     int w = getFieldWidth(field);
     for (int i = 1; i <= w; i++) {
-      data[i - 1] = pd->variable<T>(field, i);
+      data[i - 1] = getField<T>(field, i);
     }
     return data;
   }
 
   std::map<int, std::vector<double>>
   getMaterialVariable(const char *field); //< gets a map of a material variable
+  PioMaterialView
+  getMaterialView(const char *field); //< sparse view of a material variable
+
+  /** Expands material variables to one cell array per material and
+   *  appends each to out as <field>-<mat>, the layout written by
+   *  pio.py's writeWithExpandedCsrArray.  fields defaults to every
+   *  array with one value per CSR entry and mats to all materials;
+   *  with scale set the values are divided by vcell.  Only two cell
+   *  arrays are held at a time: one is expanded while the previous
+   *  one is written.  The caller commits out.  Returns 0 on success.
+   **/
+  int expandMaterialVariables(
+      PioWriter &out, std::vector<std::string> fields = {}, bool scale = false,
+      std::vector<int> mats = std::vector<int>());
+
+  /** 1 / vcell per cell, the scale factors of material variables
+   *  divided by volume.  Cells with no volume get 0 rather than inf.
+   *  Empty if the dump has no vcell.
+   **/
+  std::vector<double> getInverseVolume();
+
+  int writeUniqMap(const char *filename); //< saves uniqMap, 0 on success
+  int readUniqMap(const char *filename);  //< loads a saved map, 0 on success
 
   template <class T> const T *getUniqMap(const T *field);
   template <class T> const T **getUniqMap(const T **field, const int n);
   template <class T> void deleteArray(const T **field, const int n);
 
+  /** Dense cell arrays [nCell] of a material variable, element m - 1
+   *  for material m (0 in cells without it).  The arrays are cached as
+   *  well when a cache is set.
+   **/
   std::vector<std::shared_ptr<double>> getDChunkField(const char *field);
 
-  // initializer takes dump file name and request for unique ids
-  PioInterface(const char *name, const int uniq = 0, const int verbose = 0);
+  // initializer takes dump file name and request for unique ids; reads
+  // and phase timings are recorded in stats if it is given
+  PioInterface(const char *name, const int uniq = 0, const int verbose = 0,
+               const int nThreads = 0, PIOStats *stats = nullptr);
   ~PioInterface();
 };
 
@@ -0,0 +1,487 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOMPI_HPP_
+#define PIOMPI_HPP_
+
+// Only code that includes this header needs MPI; build it with the
+// MPI compiler wrapper, e.g. mpicxx.
+#include <mpi.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pio.hpp"
+#include "pioReduce.hpp"
+
+/** MPI datatype matching T **/
+template <typename T> inline MPI_Datatype pioMpiType();
+template <> inline MPI_Datatype pioMpiType<double>() { return MPI_DOUBLE; }
+template <> inline MPI_Datatype pioMpiType<int>() { return MPI_INT; }
+template <> inline MPI_Datatype pioMpiType<int64_t>() { return MPI_INT64_T; }
+template <> inline MPI_Datatype pioMpiType<uint64_t>() { return MPI_UINT64_T; }
+
+/** Reads a dump partitioned across the ranks of an MPI communicator.
+ *
+ *  Every rank owns a set of cells and only ever reads its own slices
+ *  of cell arrays and the matching entries of the material (chunk_)
+ *  arrays, so no rank holds a whole array:
+ *
+ *    MPI_Init(&argc, &argv);
+ *    PioPartition part("run-dmp000100", MPI_COMM_WORLD,
+ *                      PioPartition::curve);
+ *    std::vector<double> p = part.readCells("pres_0");   // owned cells
+ *    std::vector<double> v = part.readMaterial("chunk_vol_0");
+ *    double total = part.allReduce(sum(p), MPI_SUM);
+ *    std::vector<double> all = part.gatherCells(p);     // on rank 0
+ *
+ *  With contiguous each rank owns an equal run of cells in dump order.
+ *  With curve cells are ordered along a Morton curve through their
+ *  centers and the curve is cut into runs of about equal size, so each
+ *  rank owns a compact piece of the domain; cut points come from a
+ *  sample of the keys.  Owned cells are kept in dump order either way
+ *  so that reads stay ordered.
+ *
+ *  The index is read and broadcast by rank 0 and the offsets of each
+ *  rank's material entries follow from an exclusive scan of its
+ *  chunk_nummat counts.  All constructors and helpers that take no
+ *  root are collective.
+ *
+ *  Reads that come up short are reported by the ranks they fail on
+ *  and then fail on every rank: readCells() and readMaterial() return
+ *  an empty vector, and a partition that cannot be built owns no
+ *  cells and has failed() set.
+ **/
+class PioPartition {
+public:
+  enum Scheme { contiguous, curve };
+
+  PioPartition(const std::string &filename, MPI_Comm comm = MPI_COMM_WORLD,
+               Scheme scheme = contiguous, bool useMmap = false)
+      : comm_(comm), scheme_(scheme) {
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &size_);
+    pio_.reset(new PIO(filename, false, useMmap, broadcastIndex(filename)));
+    nCell_ = pio_->numcell();
+    nDim_ = std::min(pio_->ndim(), 3);
+    auto it = pio_->arrays.find("chunk_mat_0");
+    csrLength_ = it == pio_->arrays.end() ? 0 : int64_t(it->second.length);
+
+    // equal runs of cells, and the entries of each run in the
+    // material arrays
+    first_ = nCell_ * rank_ / size_;
+    const int64_t n = nCell_ * (rank_ + 1) / size_ - first_;
+    std::vector<int64_t> nummat(n, 0);
+    if (csrLength_ > 0 && pio_->arrays.count("chunk_nummat_0") == 1) {
+      std::vector<double> x(n);
+      const bool ok =
+          pio_->readArrayRangeInto("chunk_nummat_0", first_, n, x.data()) == n;
+      if (!allRead(ok, "chunk_nummat_0")) {
+        fail();
+        return;
+      }
+      for (int64_t i = 0; i < n; i++)
+        nummat[i] = int64_t(x[i]);
+    }
+    int64_t local = 0, csrFirst = 0;
+    for (int64_t i = 0; i < n; i++)
+      local += nummat[i];
+    MPI_Exscan(&local, &csrFirst, 1, MPI_INT64_T, MPI_SUM, comm_);
+    if (rank_ == 0)
+      csrFirst = 0;
+
+    if (scheme_ == curve && size_ > 1) {
+      if (!redistribute(n, csrFirst, nummat)) {
+        fail();
+        return;
+      }
+    } else {
+      cells_.resize(n);
+      matStart_.resize(n + 1);
+      matStart_[0] = 0;
+      for (int64_t i = 0; i < n; i++) {
+        cells_[i] = first_ + i;
+        matStart_[i + 1] = matStart_[i] + nummat[i];
+      }
+      csrFirst_ = csrFirst;
+    }
+    if (csrLength_ > 0) {
+      std::vector<double> m = readMaterial("chunk_mat_0");
+      if (int64_t(m.size()) != matStart_.back()) {
+        fail();
+        return;
+      }
+      matIds_.assign(m.begin(), m.end());
+    }
+  }
+  PioPartition(const PioPartition &) = delete;
+  PioPartition &operator=(const PioPartition &) = delete;
+
+  MPI_Comm comm() const { return comm_; }
+  int rank() const { return rank_; }
+  int size() const { return size_; }
+  int nDim() const { return nDim_; }
+  int64_t nCell() const { return nCell_; } //< over all ranks
+  int64_t nLocal() const { return cells_.size(); }
+  /** true if a read came up short while building the partition **/
+  bool failed() const { return failed_; }
+  PIO &pio() { return *pio_; }
+  /** dump indices of the owned cells, ascending **/
+  const std::vector<int64_t> &cells() const { return cells_; }
+  /** where the material entries of each owned cell start in the
+   *  arrays returned by readMaterial() [nLocal + 1]
+   **/
+  const std::vector<int64_t> &matStartIndex() const { return matStart_; }
+  /** material id of each owned material entry **/
+  const std::vector<int> &matIds() const { return matIds_; }
+
+  /** Reads the owned cells of cell array name (e.g. pres_0), in the
+   *  order of cells().  Returns an empty vector if name is not a cell
+   *  array or the read comes up short on any rank.
+   **/
+  std::vector<double> readCells(const std::string &name) {
+    std::vector<double> v;
+    auto it = pio_->arrays.find(name);
+    if (it == pio_->arrays.end() || int64_t(it->second.length) != nCell_) {
+      std::cout << "Not a cell array: " << name << std::endl;
+      return v;
+    }
+    if (scheme_ == contiguous || size_ == 1) {
+      v.resize(cells_.size());
+      v.resize(pio_->readArrayRangeInto(name, first_, v.size(), v.data()));
+    } else if (!cells_.empty()) {
+      v = pio_->readArrayGather(name, cells_);
+    }
+    if (!allRead(v.size() == cells_.size(), name))
+      std::vector<double>().swap(v);
+    return v;
+  }
+
+  /** Reads the material entries of the owned cells of material array
+   *  name (e.g. chunk_vol_0); the entries of owned cell i are
+   *  [matStartIndex()[i], matStartIndex()[i + 1]).  Returns an empty
+   *  vector if name is not a material array or the read comes up short
+   *  on any rank.
+   **/
+  std::vector<double> readMaterial(const std::string &name) {
+    std::vector<double> v;
+    auto it = pio_->arrays.find(name);
+    if (it == pio_->arrays.end() || csrLength_ == 0 ||
+        int64_t(it->second.length) != csrLength_ ||
+        name.compare(0, 6, "chunk_") != 0) {
+      std::cout << "Not a material array: " << name << std::endl;
+      return v;
+    }
+    if (scheme_ == contiguous || size_ == 1) {
+      v.resize(matStart_.back());
+      v.resize(pio_->readArrayRangeInto(name, csrFirst_, v.size(), v.data()));
+    } else if (!entries_.empty()) {
+      v = pio_->readArrayGather(name, entries_);
+    }
+    if (!allRead(int64_t(v.size()) == matStart_.back(), name))
+      std::vector<double>().swap(v);
+    return v;
+  }
+
+  /** Combines x over all ranks with op (MPI_SUM, MPI_MIN, ...) **/
+  template <typename T> T allReduce(T x, MPI_Op op) const {
+    T r;
+    MPI_Allreduce(&x, &r, 1, pioMpiType<T>(), op, comm_);
+    return r;
+  }
+
+  /** Combines v element by element over all ranks, in place; v must
+   *  have the same size on every rank.
+   **/
+  template <typename T> void allReduce(std::vector<T> &v, MPI_Op op) const {
+    MPI_Allreduce(MPI_IN_PLACE, v.data(), int(v.size()), pioMpiType<T>(), op,
+                  comm_);
+  }
+
+  /** Merges the statistics of every rank, e.g. from local PioReducer
+   *  style accumulation; the histograms must have the same bins.
+   **/
+  PioStatistics allReduce(const PioStatistics &s) const {
+    PioStatistics r = s;
+    int64_t counts[4] = {s.count, s.nans, s.below, s.above};
+    MPI_Allreduce(MPI_IN_PLACE, counts, 4, MPI_INT64_T, MPI_SUM, comm_);
+    r.count = counts[0];
+    r.nans = counts[1];
+    r.below = counts[2];
+    r.above = counts[3];
+    r.sum = allReduce(s.sum, MPI_SUM);
+    r.min = allReduce(s.min, MPI_MIN);
+    r.max = allReduce(s.max, MPI_MAX);
+    allReduce(r.bins, MPI_SUM);
+    return r;
+  }
+
+  /** Gathers a value per owned cell (in the order of cells()) from
+   *  every rank into one array in dump order on root; other ranks get
+   *  an empty vector.  Limited to fewer than 2^31 cells.
+   **/
+  template <typename T>
+  std::vector<T> gatherCells(const std::vector<T> &local, int root = 0) const {
+    std::vector<T> all;
+    if (nCell_ > INT_MAX || int64_t(local.size()) != nLocal()) {
+      if (rank_ == root)
+        std::cout << "Unable to gather cells" << std::endl;
+      return all;
+    }
+    const int n = local.size();
+    std::vector<int> counts(rank_ == root ? size_ : 0), displs;
+    MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm_);
+    if (rank_ == root) {
+      displs.assign(size_, 0);
+      for (int r = 1; r < size_; r++)
+        displs[r] = displs[r - 1] + counts[r - 1];
+      all.resize(nCell_);
+    }
+    const bool inOrder = scheme_ == contiguous || size_ == 1;
+    std::vector<T> values(inOrder || rank_ != root ? 0 : nCell_);
+    MPI_Gatherv(local.data(), n, pioMpiType<T>(),
+                inOrder ? all.data() : values.data(), counts.data(),
+                displs.data(), pioMpiType<T>(), root, comm_);
+    if (inOrder)
+      return all;
+
+    // owned cells of the curve partition are scattered over the dump
+    std::vector<int64_t> cells(rank_ == root ? nCell_ : 0);
+    MPI_Gatherv(cells_.data(), n, MPI_INT64_T, cells.data(), counts.data(),
+                displs.data(), MPI_INT64_T, root, comm_);
+    for (size_t i = 0; i < cells.size(); i++)
+      all[cells[i]] = values[i];
+    return all;
+  }
+
+private:
+  /** A cell on its way to its owner in the curve partition **/
+  struct Record {
+    uint64_t key; //< Morton key of the center
+    int64_t cell;
+    int64_t csr;    //< first material entry in the dump
+    int64_t nummat; //< material entries
+  };
+
+  MPI_Comm comm_;
+  Scheme scheme_;
+  int rank_ = 0;
+  int size_ = 1;
+  std::unique_ptr<PIO> pio_;
+  int64_t nCell_ = 0;
+  int nDim_ = 0;
+  int64_t csrLength_ = 0;
+  int64_t first_ = 0;    //< first owned cell (contiguous)
+  int64_t csrFirst_ = 0; //< first owned material entry (contiguous)
+  std::vector<int64_t> cells_;
+  std::vector<int64_t> matStart_;
+  std::vector<int64_t> entries_; //< owned material entries (curve)
+  std::vector<int> matIds_;
+  bool failed_ = false;
+
+  /** Reports name on this rank if ok is false; true on every rank if
+   *  ok is true on every rank
+   **/
+  bool allRead(bool ok, const std::string &name) const {
+    if (!ok)
+      std::cout << "Rank " << rank_ << " unable to read " << name << std::endl;
+    int all = ok;
+    MPI_Allreduce(MPI_IN_PLACE, &all, 1, MPI_INT, MPI_LAND, comm_);
+    return all != 0;
+  }
+
+  /** Leaves the partition empty after a failed read **/
+  void fail() {
+    failed_ = true;
+    cells_.clear();
+    entries_.clear();
+    matIds_.clear();
+    matStart_.assign(1, 0);
+    first_ = csrFirst_ = 0;
+  }
+
+  /** Reads the index on rank 0 and hands it to every rank **/
+  std::shared_ptr<PIOIndex> broadcastIndex(const std::string &filename) {
+    PIOHeader h;
+    memset(&h, 0, sizeof(h));
+    std::vector<char> block;
+    if (rank_ == 0) {
+      int fd = open(filename.c_str(), O_RDONLY);
+      if (fd >= 0 && PIO::preadFull(fd, 0, sizeof(h), &h) == sizeof(h) &&
+          !strncmp(h.filetype, "pio_file", 8) && h.two == 2.0)
+        block = PIO::readIndexBlock(fd, h);
+      if (fd >= 0)
+        close(fd);
+    }
+    int64_t n = block.size();
+    MPI_Bcast(&h, sizeof(h), MPI_BYTE, 0, comm_);
+    MPI_Bcast(&n, 1, MPI_INT64_T, 0, comm_);
+    block.resize(n);
+    for (int64_t k = 0; k < n; k += INT_MAX) {
+      MPI_Bcast(block.data() + k, int(std::min<int64_t>(INT_MAX, n - k)),
+                MPI_BYTE, 0, comm_);
+    }
+    auto index = std::make_shared<PIOIndex>();
+    PIO::parseIndex(h, block, *index);
+    return index;
+  }
+
+  /** spreads the low bits of x so that there are nDim - 1 zero bits
+   *  between consecutive bits
+   **/
+  static uint64_t spread(uint64_t x, int nDim) {
+    uint64_t r = 0;
+    for (int b = 0; b < 64 / nDim; b++)
+      r |= ((x >> b) & 1) << (b * nDim);
+    return r;
+  }
+
+  /** Moves the cells of the run [first_, first_ + n) to the ranks
+   *  owning their piece of the Morton curve; false if the centers
+   *  cannot be read on some rank
+   **/
+  bool redistribute(int64_t n, int64_t csrFirst,
+                    const std::vector<int64_t> &nummat) {
+    // quantize the centers over the bounding box of all cells
+    std::vector<std::vector<double>> c(nDim_, std::vector<double>(n));
+    double lo[3], hi[3];
+    for (int d = 0; d < nDim_; d++) {
+      const std::string name = "cell_center_" + std::to_string(d + 1);
+      const bool ok =
+          pio_->readArrayRangeInto(name, first_, n, c[d].data()) == n;
+      if (!allRead(ok, name))
+        return false;
+      lo[d] = HUGE_VAL;
+      hi[d] = -HUGE_VAL;
+      for (int64_t i = 0; i < n; i++) {
+        lo[d] = std::min(lo[d], c[d][i]);
+        hi[d] = std::max(hi[d], c[d][i]);
+      }
+      lo[d] = allReduce(lo[d], MPI_MIN);
+      hi[d] = allReduce(hi[d], MPI_MAX);
+    }
+    const int bits = nDim_ > 0 ? 63 / nDim_ : 0;
+    const double scale = double((uint64_t(1) << bits) - 1);
+    std::vector<Record> rec(n);
+    int64_t csr = csrFirst;
+    for (int64_t i = 0; i < n; i++) {
+      uint64_t key = 0;
+      for (int d = 0; d < nDim_; d++) {
+        const double w = hi[d] > lo[d] ? (c[d][i] - lo[d]) / (hi[d] - lo[d])
+                                       : 0.0;
+        key |= spread(uint64_t(w * scale), nDim_) << d;
+      }
+      rec[i] = {key, first_ + i, csr, nummat[i]};
+      csr += nummat[i];
+    }
+    std::vector<std::vector<double>>().swap(c);
+    auto less = [](const Record &a, const Record &b) {
+      return a.key < b.key || (a.key == b.key && a.cell < b.cell);
+    };
+    std::sort(rec.begin(), rec.end(), less);
+
+    // cut points from a regular sample of every rank's sorted keys
+    const int nSample = std::max(size_, 256);
+    std::vector<Record> sample;
+    for (int s = 0; s < nSample && n > 0; s++)
+      sample.push_back(rec[(2 * s + 1) * n / (2 * nSample)]);
+    MPI_Datatype type;
+    MPI_Type_contiguous(sizeof(Record), MPI_BYTE, &type);
+    MPI_Type_commit(&type);
+    const int nS = sample.size();
+    std::vector<int> counts(size_), displs(size_);
+    MPI_Allgather(&nS, 1, MPI_INT, counts.data(), 1, MPI_INT, comm_);
+    int total = 0;
+    for (int r = 0; r < size_; r++) {
+      displs[r] = total;
+      total += counts[r];
+    }
+    // samples are weighted by the cells they stand for, so that ranks
+    // with fewer cells move the cut points less
+    std::vector<Record> all(total);
+    MPI_Allgatherv(sample.data(), nS, type, all.data(), counts.data(),
+                   displs.data(), type, comm_);
+    std::vector<double> weight(total);
+    std::vector<int64_t> nRun(size_);
+    MPI_Allgather(&n, 1, MPI_INT64_T, nRun.data(), 1, MPI_INT64_T, comm_);
+    for (int r = 0; r < size_; r++) {
+      for (int s = 0; s < counts[r]; s++)
+        weight[displs[r] + s] = double(nRun[r]) / counts[r];
+    }
+    std::vector<int> order(total);
+    for (int s = 0; s < total; s++)
+      order[s] = s;
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return less(all[a], all[b]);
+    });
+    std::vector<Record> cuts;
+    double acc = 0.0;
+    for (int s = 0; s < total && int(cuts.size()) < size_ - 1; s++) {
+      acc += weight[order[s]];
+      if (acc >= double(nCell_) * (cuts.size() + 1) / size_)
+        cuts.push_back(all[order[s]]);
+    }
+    while (int(cuts.size()) < size_ - 1)
+      cuts.push_back({~0ull, INT64_MAX, 0, 0});
+
+    // send every cell to the rank owning its piece of the curve
+    std::vector<int> sendCounts(size_, 0), recvCounts(size_);
+    for (int64_t i = 0, r = 0; i < n; i++) {
+      while (r < size_ - 1 && !less(rec[i], cuts[r]))
+        r++;
+      sendCounts[r]++;
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT,
+                 comm_);
+    std::vector<int> sendDispls(size_, 0), recvDispls(size_, 0);
+    for (int r = 1; r < size_; r++) {
+      sendDispls[r] = sendDispls[r - 1] + sendCounts[r - 1];
+      recvDispls[r] = recvDispls[r - 1] + recvCounts[r - 1];
+    }
+    std::vector<Record> mine(recvDispls[size_ - 1] + recvCounts[size_ - 1]);
+    MPI_Alltoallv(rec.data(), sendCounts.data(), sendDispls.data(), type,
+                  mine.data(), recvCounts.data(), recvDispls.data(), type,
+                  comm_);
+    MPI_Type_free(&type);
+    std::vector<Record>().swap(rec);
+
+    // owned cells and their material entries in dump order
+    std::sort(mine.begin(), mine.end(), [](const Record &a, const Record &b) {
+      return a.cell < b.cell;
+    });
+    cells_.resize(mine.size());
+    matStart_.resize(mine.size() + 1);
+    matStart_[0] = 0;
+    for (size_t i = 0; i < mine.size(); i++) {
+      cells_[i] = mine[i].cell;
+      matStart_[i + 1] = matStart_[i] + mine[i].nummat;
+    }
+    entries_.reserve(matStart_.back());
+    for (auto &m : mine) {
+      for (int64_t k = 0; k < m.nummat; k++)
+        entries_.push_back(m.csr + k);
+    }
+    return true;
+  }
+};
+
+#endif
+
+// END
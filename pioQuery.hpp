@@ -0,0 +1,242 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOQUERY_HPP_
+#define PIOQUERY_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pioColumnar.hpp"
+#include "pioInterface.hpp"
+
+/** One condition on a cell array: lo <= x < hi, or x == lo if equal
+ *  is set.  NaN never matches.
+ **/
+struct PioPredicate {
+  std::string name; //< array name, e.g. cell_center_1
+  double lo;
+  double hi;
+  bool equal;
+};
+
+/** Selects the cells for which every predicate holds and gathers
+ *  variables for them, the C++ counterpart of the mask / argwhere /
+ *  index pattern of pioExplore.py:
+ *
+ *    PioQuery q(pi);
+ *    q.leaves().range("cell_center_1", 0.2, 0.4).equal("cell_level_0", 3);
+ *    std::vector<int64_t> cells = q.run();
+ *    auto v = q.gather(cells, {"pres_0", "vcell_0"});
+ *
+ *  The cells are processed in blocks of blockSize in parallel; only
+ *  the slices of the predicate arrays for a block are read, never
+ *  whole arrays, and the remaining predicates of a block are not read
+ *  once no cell of it is left.  The comparison loops are branch free
+ *  so that the compiler vectorizes them.
+ *
+ *  With useChunkStats() the blocks follow the chunks of a columnar
+ *  copy of the dump (see PioColumnar) and a block is skipped without
+ *  reading anything when the min/max of one of its predicate arrays
+ *  rules out a match.
+ **/
+class PioQuery {
+public:
+  PioQuery(PioInterface &pi, int nThreads = 0, int64_t blockSize = 1 << 16)
+      : pi_(pi), nThreads_(nThreads),
+        blockSize_(std::max<int64_t>(1, blockSize)) {}
+
+  /** lo <= name < hi **/
+  PioQuery &range(const std::string &name, double lo, double hi) {
+    predicates_.push_back({name, lo, hi, false});
+    return *this;
+  }
+  /** name == value **/
+  PioQuery &equal(const std::string &name, double value) {
+    predicates_.push_back({name, value, value, true});
+    return *this;
+  }
+  /** leaf cells only (cell_daughter == 0) **/
+  PioQuery &leaves() { return equal("cell_daughter_0", 0.0); }
+  /** cells whose center lies in [lo, hi) in each of the nDim dims **/
+  PioQuery &box(const double *lo, const double *hi) {
+    for (int d = 0; d < pi_.nDim(); d++)
+      range("cell_center_" + std::to_string(d + 1), lo[d], hi[d]);
+    return *this;
+  }
+  void clear() { predicates_.clear(); }
+  const std::vector<PioPredicate> &predicates() const { return predicates_; }
+
+  /** Uses the zone maps of columnar, which must have been transcoded
+   *  from the dump of pi (see PioColumnar::matches()), to skip blocks.
+   *  The block size becomes the chunk size of columnar.
+   **/
+  void useChunkStats(PioColumnar &columnar) {
+    columnar_ = &columnar;
+    blockSize_ = std::max<int64_t>(1, columnar.chunkSize());
+  }
+
+  int64_t blockSize() const { return blockSize_; }
+  int64_t skippedBlocks() const { return skipped_; } //< by the last run()
+  int64_t unreadCells() const { return unread_; }     //< by the last run()
+
+  /** Returns the cells matching all predicates in ascending order, or
+   *  all cells if there are none.  Returns an empty list if a
+   *  predicate names an array that is not a cell array of the dump.
+   *  Blocks whose predicate arrays cannot be read are left out of the
+   *  result and their cells counted in unreadCells().
+   **/
+  std::vector<int64_t> run() {
+    PIOStats::Scope scope(pi_.stats(), "phase", "query");
+    PIO &pio = pi_.pio();
+    const int64_t nCell = pi_.nCell();
+    std::vector<int64_t> cells;
+    skipped_ = 0;
+    unread_ = 0;
+    std::vector<std::vector<PioChunkInfo>> zones(predicates_.size());
+    for (size_t p = 0; p < predicates_.size(); p++) {
+      const std::string &name = predicates_[p].name;
+      auto it = pio.arrays.find(name);
+      if (it == pio.arrays.end() ||
+          static_cast<int64_t>(it->second.length) != nCell) {
+        std::cout << "Not a cell array: " << name << std::endl;
+        return cells;
+      }
+      if (columnar_ && columnar_->length(name) == nCell)
+        zones[p] = columnar_->chunks(name);
+    }
+
+    const int64_t nBlocks = (nCell + blockSize_ - 1) / blockSize_;
+    std::vector<std::vector<int64_t>> found(nBlocks);
+    std::atomic<int64_t> skipped(0), unread(0);
+    pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+      const int64_t start = b * blockSize_;
+      const int64_t n = std::min(blockSize_, nCell - start);
+      for (size_t p = 0; p < predicates_.size(); p++) {
+        if (!zones[p].empty() && !mayMatch(predicates_[p], zones[p][b])) {
+          skipped++;
+          return;
+        }
+      }
+      std::vector<uint8_t> mask(n, 1);
+      std::vector<double> x(n);
+      int64_t left = n;
+      for (size_t p = 0; p < predicates_.size() && left > 0; p++) {
+        const PioPredicate &q = predicates_[p];
+        if (pio.readArrayRangeInto(q.name, start, n, x.data()) != n) {
+          unread += n;
+          return;
+        }
+        if (q.equal)
+          left = applyEqual(x.data(), n, q.lo, mask.data());
+        else
+          left = applyRange(x.data(), n, q.lo, q.hi, mask.data());
+      }
+      if (left > 0) {
+        found[b].resize(left + 1); // compact() stores one past the end
+        compact(mask.data(), n, start, found[b].data());
+        found[b].pop_back();
+      }
+    });
+    skipped_ = skipped;
+    unread_ = unread;
+    if (unread_)
+      std::cout << "Unable to read " << unread_ << " cells of the query"
+                << std::endl;
+
+    // concatenate the blocks in order
+    std::vector<int64_t> offset(nBlocks + 1, 0);
+    for (int64_t b = 0; b < nBlocks; b++)
+      offset[b + 1] = offset[b] + found[b].size();
+    cells.resize(offset[nBlocks]);
+    pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+      std::copy(found[b].begin(), found[b].end(), cells.begin() + offset[b]);
+      std::vector<int64_t>().swap(found[b]);
+    });
+    return cells;
+  }
+
+  /** Reads arrays names at cells (sorted, as returned by run()),
+   *  one result per name in the same order, in parallel over names.
+   *  Missing arrays come back empty.
+   **/
+  std::vector<std::vector<double>>
+  gather(const std::vector<int64_t> &cells,
+         const std::vector<std::string> &names) {
+    std::vector<std::vector<double>> result(names.size());
+    PIO &pio = pi_.pio();
+    pioParallelFor(names.size(), nThreads_, [&](int64_t i) {
+      result[i] = pio.readArrayGather(names[i], cells);
+    });
+    return result;
+  }
+
+private:
+  PioInterface &pi_;
+  int nThreads_;
+  int64_t blockSize_;
+  PioColumnar *columnar_ = nullptr;
+  std::vector<PioPredicate> predicates_;
+  int64_t skipped_ = 0;
+  int64_t unread_ = 0;
+
+  static bool mayMatch(const PioPredicate &q, const PioChunkInfo &c) {
+    if (q.equal)
+      return q.lo >= c.min && q.lo <= c.max;
+    return c.max >= q.lo && c.min < q.hi;
+  }
+
+  // The kernels below combine the comparisons with & rather than &&
+  // so that the loops have no branches; they return the number of
+  // cells still selected.
+
+  static int64_t applyRange(const double *x, int64_t n, double lo, double hi,
+                            uint8_t *mask) {
+    int64_t left = 0;
+    for (int64_t i = 0; i < n; i++) {
+      const uint8_t m = mask[i] & (x[i] >= lo) & (x[i] < hi);
+      mask[i] = m;
+      left += m;
+    }
+    return left;
+  }
+
+  static int64_t applyEqual(const double *x, int64_t n, double v,
+                            uint8_t *mask) {
+    int64_t left = 0;
+    for (int64_t i = 0; i < n; i++) {
+      const uint8_t m = mask[i] & (x[i] == v);
+      mask[i] = m;
+      left += m;
+    }
+    return left;
+  }
+
+  static void compact(const uint8_t *mask, int64_t n, int64_t start,
+                      int64_t *out) {
+    int64_t k = 0;
+    for (int64_t i = 0; i < n; i++) {
+      out[k] = start + i;
+      k += mask[i];
+    }
+  }
+};
+
+#endif
+
+// END
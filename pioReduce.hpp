@@ -0,0 +1,290 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOREDUCE_HPP_
+#define PIOREDUCE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pioInterface.hpp"
+
+/** Count, min, max, sum and histogram of a set of values.  NaNs are
+ *  only counted in nans.  The histogram has bins.size() equal bins
+ *  over [lo, hi]; values outside go to below and above.
+ **/
+struct PioStatistics {
+  int64_t count = 0;
+  int64_t nans = 0;
+  double min = HUGE_VAL;
+  double max = -HUGE_VAL;
+  double sum = 0.0;
+  double lo = 0.0;
+  double hi = 0.0;
+  std::vector<int64_t> bins;
+  int64_t below = 0;
+  int64_t above = 0;
+
+  double mean() const { return count ? sum / count : NAN; }
+
+  void add(double x) {
+    if (std::isnan(x)) {
+      nans++;
+      return;
+    }
+    count++;
+    sum += x;
+    min = std::min(min, x);
+    max = std::max(max, x);
+    if (bins.empty())
+      return;
+    if (x < lo) {
+      below++;
+    } else if (x > hi) {
+      above++;
+    } else {
+      const int64_t n = bins.size();
+      const int64_t b = hi > lo ? int64_t((x - lo) / (hi - lo) * n) : 0;
+      bins[std::min(b, n - 1)]++;
+    }
+  }
+
+  void merge(const PioStatistics &o) {
+    count += o.count;
+    nans += o.nans;
+    sum += o.sum;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+    for (size_t b = 0; b < bins.size() && b < o.bins.size(); b++)
+      bins[b] += o.bins[b];
+    below += o.below;
+    above += o.above;
+  }
+};
+
+/** Statistics of one variable, overall and broken down by AMR level
+ *  and by material.  Only levels and materials with at least one
+ *  value (NaNs included) are present.  Values in blocks that could not
+ *  be read are left out and counted in unread.
+ **/
+struct PioReduction {
+  std::string name;
+  bool material = false; //< name is a material (chunk_) variable
+  int64_t unread = 0;    //< values skipped because a read came up short
+  PioStatistics all;
+  std::map<int, PioStatistics> byLevel;
+  std::map<int, PioStatistics> byMaterial;
+};
+
+/** Computes PioReduction statistics of several variables in one
+ *  streaming pass over blocks of cells:
+ *
+ *    PioReducer r(pi);
+ *    auto s = r.reduce({"pres_0", "vcell_0", "chunk_vol_0"}, 100);
+ *    std::cout << s[2].byMaterial[1].mean() << std::endl;
+ *
+ *  Cell variables (one value per cell) are broken down by the level
+ *  of the cell and by every material present in it; material
+ *  variables (one value per chunk_mat entry) by the material of the
+ *  entry and the level of its cell.
+ *
+ *  Each thread takes blocks of blockSize cells, reads the slices of
+ *  all variables for the block and adds them to its own accumulators,
+ *  which are merged once all blocks are done.  Only a block per thread
+ *  and the mesh levels and material layout are held in memory.
+ **/
+class PioReducer {
+public:
+  PioReducer(PioInterface &pi, int nThreads = 0, int64_t blockSize = 1 << 16)
+      : pi_(pi), nThreads_(nThreads),
+        blockSize_(std::max<int64_t>(1, blockSize)) {}
+
+  /** Reduces names (full array names such as pres_0).  With nBins > 0
+   *  every variable gets a histogram of nBins bins over [lo, hi];
+   *  if lo >= hi the range is the min and max of each variable, found
+   *  by an extra pass without histograms.  Arrays that are neither
+   *  cell nor material arrays come back with a count of zero.
+   **/
+  std::vector<PioReduction> reduce(const std::vector<std::string> &names,
+                                   int nBins = 0, double lo = 0.0,
+                                   double hi = 0.0) {
+    PIOStats::Scope scope(pi_.stats(), "phase", "reduce");
+    std::vector<int> kind = classify(names);
+    std::vector<double> los(names.size(), lo), his(names.size(), hi);
+    if (nBins > 0 && !(lo < hi)) {
+      std::vector<PioReduction> range = pass(names, kind, 0, los, his);
+      for (size_t v = 0; v < names.size(); v++) {
+        los[v] = range[v].all.min;
+        his[v] = range[v].all.max;
+      }
+    }
+    return pass(names, kind, std::max(0, nBins), los, his);
+  }
+
+private:
+  PioInterface &pi_;
+  int nThreads_;
+  int64_t blockSize_;
+
+  /** 1 for cell arrays, 2 for material arrays, 0 for anything else **/
+  std::vector<int> classify(const std::vector<std::string> &names) {
+    PIO &pio = pi_.pio();
+    const int64_t nCell = pi_.nCell();
+    const int64_t csrLength = pi_.matIds().size();
+    const bool haveMats =
+        static_cast<int64_t>(pi_.matStartIndex().size()) == nCell + 1 &&
+        csrLength > 0;
+    std::vector<int> kind(names.size(), 0);
+    for (size_t v = 0; v < names.size(); v++) {
+      auto it = pio.arrays.find(names[v]);
+      const int64_t length =
+          it == pio.arrays.end() ? -1 : int64_t(it->second.length);
+      if (haveMats && length == csrLength &&
+          names[v].compare(0, 6, "chunk_") == 0)
+        kind[v] = 2;
+      else if (length == nCell)
+        kind[v] = 1;
+      else
+        std::cout << "Not a cell or material array: " << names[v]
+                  << std::endl;
+    }
+    return kind;
+  }
+
+  std::vector<PioReduction> pass(const std::vector<std::string> &names,
+                                 const std::vector<int> &kind, int nBins,
+                                 const std::vector<double> &los,
+                                 const std::vector<double> &his) {
+    PIO &pio = pi_.pio();
+    const int64_t nCell = pi_.nCell();
+    const std::vector<int> &level = pi_.level();
+    const std::vector<int> &matIds = pi_.matIds();
+    const std::vector<int64_t> &matStart = pi_.matStartIndex();
+    const int nLevel = pi_.nLevel();
+    const int nMat = pi_.nMat();
+    const bool haveMats = static_cast<int64_t>(matStart.size()) == nCell + 1;
+
+    // accumulator g of a variable: 0 all, 1..nLevel levels, then
+    // materials 1..nMat
+    const int nGroups = 1 + nLevel + nMat;
+    const int nVars = names.size();
+    std::vector<PioStatistics> init(nVars * nGroups);
+    for (int v = 0; v < nVars; v++) {
+      for (int g = 0; g < nGroups; g++) {
+        auto &s = init[v * nGroups + g];
+        s.lo = los[v];
+        s.hi = his[v];
+        s.bins.assign(nBins, 0);
+      }
+    }
+
+    int nWorkers = nThreads_;
+    if (nWorkers <= 0)
+      nWorkers = std::max(1u, std::thread::hardware_concurrency());
+    const int64_t nBlocks = (nCell + blockSize_ - 1) / blockSize_;
+    nWorkers = std::max<int64_t>(1, std::min<int64_t>(nWorkers, nBlocks));
+    std::vector<std::vector<PioStatistics>> acc(nWorkers, init);
+    std::vector<std::vector<int64_t>> unread(nWorkers,
+                                             std::vector<int64_t>(nVars, 0));
+    std::atomic<int64_t> next(0);
+    pioParallelFor(nWorkers, nWorkers, [&](int64_t w) {
+      std::vector<PioStatistics> &a = acc[w];
+      std::vector<double> x;
+      for (int64_t b = next++; b < nBlocks; b = next++) {
+        const int64_t start = b * blockSize_;
+        const int64_t n = std::min(blockSize_, nCell - start);
+        for (int v = 0; v < nVars; v++) {
+          PioStatistics *s = a.data() + v * nGroups;
+          if (kind[v] == 1) {
+            x.resize(n);
+            if (pio.readArrayRangeInto(names[v], start, n, x.data()) != n) {
+              unread[w][v] += n;
+              continue;
+            }
+            for (int64_t i = 0; i < n; i++) {
+              const int64_t c = start + i;
+              s[0].add(x[i]);
+              if (level[c] >= 1 && level[c] <= nLevel)
+                s[level[c]].add(x[i]);
+              for (int64_t k = haveMats ? matStart[c] : 0;
+                   haveMats && k < matStart[c + 1]; k++) {
+                if (matIds[k] >= 1 && matIds[k] <= nMat)
+                  s[nLevel + matIds[k]].add(x[i]);
+              }
+            }
+          } else if (kind[v] == 2) {
+            const int64_t k0 = matStart[start], k1 = matStart[start + n];
+            x.resize(k1 - k0);
+            if (k1 > k0 &&
+                pio.readArrayRangeInto(names[v], k0, k1 - k0, x.data()) !=
+                    k1 - k0) {
+              unread[w][v] += k1 - k0;
+              continue;
+            }
+            for (int64_t i = 0; i < n; i++) {
+              const int64_t c = start + i;
+              const bool inLevel = level[c] >= 1 && level[c] <= nLevel;
+              for (int64_t k = matStart[c]; k < matStart[c + 1]; k++) {
+                const double y = x[k - k0];
+                s[0].add(y);
+                if (inLevel)
+                  s[level[c]].add(y);
+                if (matIds[k] >= 1 && matIds[k] <= nMat)
+                  s[nLevel + matIds[k]].add(y);
+              }
+            }
+          }
+        }
+      }
+    });
+
+    // merge the per-thread accumulators
+    std::vector<PioReduction> result(nVars);
+    for (int v = 0; v < nVars; v++) {
+      PioReduction &r = result[v];
+      r.name = names[v];
+      r.material = kind[v] == 2;
+      for (auto &u : unread)
+        r.unread += u[v];
+      if (r.unread)
+        std::cout << "Unable to read " << r.unread << " values of " << r.name
+                  << std::endl;
+      for (int g = 0; g < nGroups; g++) {
+        PioStatistics s = init[v * nGroups + g];
+        for (auto &a : acc)
+          s.merge(a[v * nGroups + g]);
+        if (g == 0)
+          r.all = s;
+        else if (s.count + s.nans == 0)
+          continue;
+        else if (g <= nLevel)
+          r.byLevel[g] = s;
+        else
+          r.byMaterial[g - nLevel] = s;
+      }
+    }
+    return result;
+  }
+};
+
+#endif
+
+// END
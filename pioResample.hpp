@@ -0,0 +1,414 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIORESAMPLE_HPP_
+#define PIORESAMPLE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pioInterface.hpp"
+
+/** A box of voxels of the uniform grid of one level.  The grid of
+ *  level l has the cell size of level l over the whole domain; the box
+ *  covers voxels [first, first + n) of it.  data is stored with x
+ *  varying fastest.
+ **/
+struct PioGrid {
+  int level = 0;
+  int nDim = 0;
+  int64_t n[3] = {1, 1, 1};     //< voxels in the box per dimension
+  int64_t first[3] = {0, 0, 0}; //< first voxel of the box in the level grid
+  double origin[3] = {0.0, 0.0, 0.0}; //< lower corner of the level grid
+  double dx[3] = {1.0, 1.0, 1.0};     //< voxel size
+  int64_t unread = 0; //< cells skipped because a read came up short
+  std::vector<double> data;
+
+  int64_t size() const { return n[0] * n[1] * n[2]; }
+  /** value of voxel (i, j, k) of the box **/
+  double &operator()(int64_t i, int64_t j = 0, int64_t k = 0) {
+    return data[(k * n[1] + j) * n[0] + i];
+  }
+  /** center of voxel i of the box along dimension d **/
+  double center(int d, int64_t i) const {
+    return origin[d] + (first[d] + i + 0.5) * dx[d];
+  }
+};
+
+/** Resamples cell variables of the AMR mesh of a PioInterface onto
+ *  uniform grids.
+ *
+ *  With deposit every voxel gets the volume-weighted average of the
+ *  leaf cells overlapping it, so integrals are preserved; with inject
+ *  it gets the value of the leaf cell containing its center.  Leaf
+ *  cells coarser than the grid fill all the voxels they cover.
+ *
+ *    PioResampler r(pi);
+ *    PioGrid g = r.resample("pres_0", 4);              // whole domain
+ *    auto p = r.pyramid("pres_0", 4);                  // levels 1..4
+ *    r.forEachTile("pres_0", 6, 256, PioResampler::deposit,
+ *                  [](PioGrid &tile) { write(tile); }); // in tiles
+ *
+ *  Cells are processed in parallel in blocks of blockSize; the
+ *  bounding box of each block is computed once, so a tile only reads
+ *  the slices of the variable for the blocks that overlap it.  A
+ *  tile never holds more than its own voxels plus one entry per cell
+ *  finer than the grid that falls in it.  Voxels that no leaf cell
+ *  touches are set to fill.  Blocks whose slice cannot be read are
+ *  left out, so their voxels keep fill; their cells are counted in
+ *  PioGrid::unread.
+ **/
+class PioResampler {
+public:
+  enum Mode { deposit, inject };
+
+  PioResampler(PioInterface &pi, int nThreads = 0, int64_t blockSize = 1 << 16)
+      : pi_(pi), nThreads_(nThreads),
+        blockSize_(std::max<int64_t>(1, blockSize)),
+        nDim_(std::min(pi.nDim(), 3)), nLevel_(pi.nLevel()),
+        level_(pi.level()), daughter_(pi.daughter()) {
+    const double **dXyz = pi.dXyz();
+    const int64_t nCell = pi.nCell();
+    for (int d = 0; d < 3; d++)
+      center_[d] = d < nDim_ ? pi.center()[d].data() : nullptr;
+
+    // domain from the level 1 cells, as in PioSpatialIndex
+    half_.assign(nLevel_ + 1, {0.5, 0.5, 0.5});
+    for (int l = 1; l <= nLevel_; l++)
+      for (int d = 0; d < nDim_; d++)
+        half_[l][d] = dXyz[l][d];
+    for (int d = 0; d < 3; d++) {
+      origin_[d] = 0.0;
+      n1_[d] = 1;
+      w1_[d] = 1.0;
+    }
+    for (int d = 0; d < nDim_; d++) {
+      double lo = HUGE_VAL, hi = -HUGE_VAL;
+      for (int64_t i = 0; i < nCell; i++) {
+        if (level_[i] == 1) {
+          lo = std::min(lo, center_[d][i]);
+          hi = std::max(hi, center_[d][i]);
+        }
+      }
+      w1_[d] = 2.0 * half_[1][d];
+      origin_[d] = lo - half_[1][d];
+      n1_[d] = lo <= hi ? std::llround((hi - lo) / w1_[d]) + 1 : 0;
+    }
+
+    // bounding box of the leaf cells of each block
+    const int64_t nBlocks = (nCell + blockSize_ - 1) / blockSize_;
+    boxLo_.assign(nBlocks, {HUGE_VAL, HUGE_VAL, HUGE_VAL});
+    boxHi_.assign(nBlocks, {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL});
+    pioParallelFor(nBlocks, nThreads_, [&](int64_t b) {
+      const int64_t end = std::min(nCell, (b + 1) * blockSize_);
+      for (int64_t i = b * blockSize_; i < end; i++) {
+        const int l = level_[i];
+        if (daughter_[i] != 0 || l < 1 || l > nLevel_)
+          continue;
+        for (int d = 0; d < nDim_; d++) {
+          boxLo_[b][d] = std::min(boxLo_[b][d], center_[d][i] - half_[l][d]);
+          boxHi_[b][d] = std::max(boxHi_[b][d], center_[d][i] + half_[l][d]);
+        }
+      }
+    });
+  }
+
+  int nDim() const { return nDim_; }
+
+  /** voxels per dimension of the whole grid of level **/
+  void gridSize(int level, int64_t *n) const {
+    for (int d = 0; d < 3; d++)
+      n[d] = d < nDim_ ? n1_[d] << (level - 1) : 1;
+  }
+
+  /** Resamples cell array name onto the grid of level, restricted to
+   *  the box of count voxels from first if they are given.  Returns an
+   *  empty grid if name is not a cell array or level is out of range.
+   **/
+  PioGrid resample(const std::string &name, int level, Mode mode = deposit,
+                   const int64_t *first = nullptr,
+                   const int64_t *count = nullptr, double fill = NAN) {
+    PIOStats::Scope scope(pi_.stats(), "phase", "resample");
+    PioGrid g;
+    PIO &pio = pi_.pio();
+    const int64_t nCell = pi_.nCell();
+    auto it = pio.arrays.find(name);
+    if (it == pio.arrays.end() || int64_t(it->second.length) != nCell ||
+        level < 1 || level > maxLevel) {
+      std::cout << "Unable to resample " << name << " at level " << level
+                << std::endl;
+      return g;
+    }
+    setupGrid(g, level, first, count);
+    g.data.assign(g.size(), fill);
+    if (g.size() == 0)
+      return g;
+
+    // blocks whose leaves overlap the box
+    std::vector<int64_t> blocks;
+    for (size_t b = 0; b < boxLo_.size(); b++) {
+      bool overlap = true;
+      for (int d = 0; d < nDim_; d++) {
+        const double lo = g.origin[d] + g.first[d] * g.dx[d];
+        const double hi = lo + g.n[d] * g.dx[d];
+        overlap = overlap && boxLo_[b][d] < hi && boxHi_[b][d] > lo;
+      }
+      if (overlap)
+        blocks.push_back(b);
+    }
+
+    // cells finer than the grid are deposited as (voxel, value)
+    // pairs per block and averaged once all blocks are done
+    std::vector<std::vector<Deposit>> fine(blocks.size());
+    std::vector<int64_t> unread(blocks.size(), 0);
+    pioParallelFor(blocks.size(), nThreads_, [&](int64_t j) {
+      const int64_t start = blocks[j] * blockSize_;
+      const int64_t n = std::min(blockSize_, nCell - start);
+      std::vector<double> x(n);
+      if (pio.readArrayRangeInto(name, start, n, x.data()) != n) {
+        unread[j] = n;
+        return;
+      }
+      for (int64_t i = 0; i < n; i++)
+        addCell(g, mode, start + i, x[i], fine[j]);
+    });
+    for (int64_t u : unread)
+      g.unread += u;
+    if (g.unread)
+      std::cout << "Unable to read " << g.unread << " cells of " << name
+                << std::endl;
+    if (mode == deposit)
+      average(g, fine);
+    return g;
+  }
+
+  /** Deposits name at level and averages it down to every coarser
+   *  level; element l - 1 is the grid of level l.  The box, if given,
+   *  is in voxels of level and is covered at each coarser level by
+   *  the voxels it overlaps.
+   **/
+  std::vector<PioGrid> pyramid(const std::string &name, int level,
+                               const int64_t *first = nullptr,
+                               const int64_t *count = nullptr,
+                               double fill = NAN) {
+    std::vector<PioGrid> grids(std::max(level, 0));
+    if (level < 1)
+      return grids;
+    grids[level - 1] = resample(name, level, deposit, first, count, fill);
+    if (grids[level - 1].data.empty())
+      return std::vector<PioGrid>();
+    for (int l = level - 1; l >= 1; l--)
+      grids[l - 1] = coarsen(grids[l], fill);
+    return grids;
+  }
+
+  /** Resamples name at level in tiles of at most tileSize voxels per
+   *  dimension, calling f(PioGrid &) for each tile in turn, so only
+   *  one tile is held at a time.
+   **/
+  template <typename F>
+  void forEachTile(const std::string &name, int level, int64_t tileSize,
+                   Mode mode, F f, double fill = NAN) {
+    int64_t n[3], first[3], count[3];
+    gridSize(level, n);
+    tileSize = std::max<int64_t>(1, tileSize);
+    for (first[2] = 0; first[2] < n[2]; first[2] += tileSize) {
+      for (first[1] = 0; first[1] < n[1]; first[1] += tileSize) {
+        for (first[0] = 0; first[0] < n[0]; first[0] += tileSize) {
+          for (int d = 0; d < 3; d++)
+            count[d] = std::min(tileSize, n[d] - first[d]);
+          PioGrid g = resample(name, level, mode, first, count, fill);
+          if (g.data.empty())
+            return;
+          f(g);
+        }
+      }
+    }
+  }
+
+private:
+  static constexpr int maxLevel = 40; //< keeps voxel indices in 64 bits
+
+  struct Deposit {
+    int64_t voxel; //< index in the box
+    double value;  //< value times volume fraction of the voxel
+    double weight; //< volume fraction of the voxel
+  };
+
+  PioInterface &pi_;
+  int nThreads_;
+  int64_t blockSize_;
+  int nDim_;
+  int nLevel_;
+  const std::vector<int> &level_;
+  const std::vector<int64_t> &daughter_;
+  const double *center_[3];
+  double origin_[3]; //< lower corner of the domain
+  double w1_[3];     //< level 1 cell width
+  int64_t n1_[3];    //< level 1 cells per dimension
+  std::vector<std::array<double, 3>> half_; //< half cell width per level
+  std::vector<std::array<double, 3>> boxLo_, boxHi_; //< per block
+
+  void setupGrid(PioGrid &g, int level, const int64_t *first,
+                 const int64_t *count) const {
+    int64_t n[3];
+    gridSize(level, n);
+    g.level = level;
+    g.nDim = nDim_;
+    for (int d = 0; d < 3; d++) {
+      g.origin[d] = origin_[d];
+      g.dx[d] = d < nDim_ ? w1_[d] / double(int64_t(1) << (level - 1)) : 1.0;
+      g.first[d] = first && d < nDim_ ? std::max<int64_t>(0, first[d]) : 0;
+      g.first[d] = std::min(g.first[d], n[d]);
+      g.n[d] = count && d < nDim_ ? std::max<int64_t>(0, count[d])
+                                  : n[d] - g.first[d];
+      g.n[d] = std::min(g.n[d], n[d] - g.first[d]);
+    }
+  }
+
+  /** Adds leaf cell i with value x to the box g **/
+  void addCell(PioGrid &g, Mode mode, int64_t i, double x,
+               std::vector<Deposit> &fine) const {
+    const int l = level_[i];
+    if (daughter_[i] != 0 || l < 1 || l > nLevel_)
+      return;
+    int64_t ic[3] = {0, 0, 0}; //< cell coordinates at its own level
+    for (int d = 0; d < nDim_; d++)
+      ic[d] = int64_t(floor((center_[d][i] - origin_[d]) / (2 * half_[l][d])));
+
+    if (l <= g.level) {
+      // covers 2^(g.level - l) voxels per dimension, clipped to the box
+      const int s = g.level - l;
+      int64_t lo[3] = {0, 0, 0}, hi[3] = {1, 1, 1};
+      for (int d = 0; d < nDim_; d++) {
+        lo[d] = std::max(ic[d] << s, g.first[d]) - g.first[d];
+        hi[d] = std::min((ic[d] + 1) << s, g.first[d] + g.n[d]) - g.first[d];
+        if (lo[d] >= hi[d])
+          return;
+      }
+      for (int64_t k = lo[2]; k < hi[2]; k++)
+        for (int64_t j = lo[1]; j < hi[1]; j++)
+          std::fill(&g(lo[0], j, k), &g(lo[0], j, k) + (hi[0] - lo[0]), x);
+      return;
+    }
+
+    // finer than the grid: one voxel
+    const int s = l - g.level;
+    int64_t v[3] = {0, 0, 0};
+    const int64_t mask = (int64_t(1) << s) - 1, half = int64_t(1) << (s - 1);
+    bool atCenter = true; //< cell contains the voxel center
+    for (int d = 0; d < nDim_; d++) {
+      v[d] = (ic[d] >> s) - g.first[d];
+      if (v[d] < 0 || v[d] >= g.n[d])
+        return;
+      atCenter = atCenter && (ic[d] & mask) == half;
+    }
+    if (mode == inject) {
+      if (atCenter)
+        g(v[0], v[1], v[2]) = x;
+      return;
+    }
+    const double w = ldexp(1.0, -s * nDim_);
+    fine.push_back({(v[2] * g.n[1] + v[1]) * g.n[0] + v[0], w * x, w});
+  }
+
+  /** Averages the deposits of cells finer than the grid per voxel,
+   *  in block and cell order so that results do not depend on the
+   *  number of threads.
+   **/
+  void average(PioGrid &g, std::vector<std::vector<Deposit>> &fine) const {
+    std::vector<Deposit> all;
+    size_t n = 0;
+    for (auto &f : fine)
+      n += f.size();
+    if (n == 0)
+      return;
+    all.reserve(n);
+    for (auto &f : fine) {
+      all.insert(all.end(), f.begin(), f.end());
+      std::vector<Deposit>().swap(f);
+    }
+    std::stable_sort(all.begin(), all.end(),
+                     [](const Deposit &a, const Deposit &b) {
+                       return a.voxel < b.voxel;
+                     });
+    for (size_t j = 0; j < all.size();) {
+      double sum = 0.0, weight = 0.0;
+      size_t k = j;
+      for (; k < all.size() && all[k].voxel == all[j].voxel; k++) {
+        sum += all[k].value;
+        weight += all[k].weight;
+      }
+      g.data[all[j].voxel] = sum / weight;
+      j = k;
+    }
+  }
+
+  /** Averages fine down by a factor two per dimension, ignoring NaN
+   *  voxels
+   **/
+  PioGrid coarsen(const PioGrid &fine, double fill) const {
+    PioGrid g;
+    g.level = fine.level - 1;
+    g.nDim = fine.nDim;
+    g.unread = fine.unread;
+    for (int d = 0; d < 3; d++) {
+      g.origin[d] = fine.origin[d];
+      if (d < nDim_) {
+        g.dx[d] = 2.0 * fine.dx[d];
+        g.first[d] = fine.first[d] >> 1;
+        g.n[d] = ((fine.first[d] + fine.n[d] + 1) >> 1) - g.first[d];
+      }
+    }
+    g.data.assign(g.size(), fill);
+    pioParallelFor(g.n[2], nThreads_, [&](int64_t k) {
+      for (int64_t j = 0; j < g.n[1]; j++) {
+        for (int64_t i = 0; i < g.n[0]; i++) {
+          const int64_t c[3] = {i, j, k};
+          int64_t lo[3] = {0, 0, 0}, hi[3] = {1, 1, 1};
+          for (int d = 0; d < nDim_; d++) {
+            const int64_t f0 = 2 * (g.first[d] + c[d]) - fine.first[d];
+            lo[d] = std::max<int64_t>(f0, 0);
+            hi[d] = std::min<int64_t>(f0 + 2, fine.n[d]);
+          }
+          double sum = 0.0;
+          int m = 0;
+          for (int64_t z = lo[2]; z < hi[2]; z++) {
+            for (int64_t y = lo[1]; y < hi[1]; y++) {
+              for (int64_t x = lo[0]; x < hi[0]; x++) {
+                const double v = fine.data[(z * fine.n[1] + y) * fine.n[0] + x];
+                if (!std::isnan(v)) {
+                  sum += v;
+                  m++;
+                }
+              }
+            }
+          }
+          if (m)
+            g.data[(k * g.n[1] + j) * g.n[0] + i] = sum / m;
+        }
+      }
+    });
+    return g;
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,324 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOSPATIALINDEX_HPP_
+#define PIOSPATIALINDEX_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "pioInterface.hpp"
+
+/** Spatial index over the AMR mesh of a PioInterface.
+ *
+ *  Every cell (leaf or not) is entered in a per-level hash keyed by
+ *  its integer coordinates at that level.  Queries start from the
+ *  level 1 cells overlapping the region of interest and walk down
+ *  through the daughters, so their cost depends on the number of
+ *  cells returned (plus the cells on the boundary of the region),
+ *  not on nCell.  Leaf cells are those with cell_daughter == 0.
+ *
+ *  The mesh arrays are borrowed from the PioInterface, which must
+ *  outlive the index.
+ **/
+class PioSpatialIndex {
+public:
+  PioSpatialIndex(PioInterface &pi, int nThreads = 0)
+      : nDim_(std::min(pi.nDim(), 3)), nLevel_(pi.nLevel()),
+        level_(pi.level()), daughter_(pi.daughter()) {
+    const double **dXyz = pi.dXyz();
+    const int64_t nCell = pi.nCell();
+    for (int d = 0; d < 3; d++)
+      center_[d] = d < nDim_ ? pi.center()[d].data() : nullptr;
+
+    // cell widths per level and the lower corner of the domain
+    width_.assign(nLevel_ + 1, {1.0, 1.0, 1.0});
+    for (int l = 1; l <= nLevel_; l++)
+      for (int d = 0; d < nDim_; d++)
+        width_[l][d] = 2.0 * dXyz[l][d];
+    for (int d = 0; d < 3; d++) {
+      origin_[d] = 0.0;
+      n1_[d] = 1;
+    }
+    for (int d = 0; d < nDim_; d++) {
+      double m = HUGE_VAL, M = -HUGE_VAL;
+      for (int64_t i = 0; i < nCell; i++) {
+        if (level_[i] == 1) {
+          m = std::min(m, center_[d][i]);
+          M = std::max(M, center_[d][i]);
+        }
+      }
+      origin_[d] = m <= M ? m - 0.5 * width_[1][d] : 0.0;
+      n1_[d] = m <= M ? (int64_t)floor((M - m) / width_[1][d] + 0.5) + 1 : 0;
+    }
+
+    // bucket cells by level, then build one hash per level in parallel
+    leaves_.resize(nLevel_ + 1);
+    std::vector<std::vector<int64_t>> byLevel(nLevel_ + 1);
+    for (int64_t i = 0; i < nCell; i++) {
+      int l = level_[i];
+      if (l < 1 || l > nLevel_)
+        continue;
+      byLevel[l].push_back(i);
+      if (daughter_[i] == 0)
+        leaves_[l].push_back(i);
+    }
+    // coordinates are packed into 64 bit keys; a level with
+    // coordinates that do not fit goes into an unordered_map instead so
+    // that no two cells share a key
+    bits_ = nDim_ == 1 ? 62 : nDim_ == 2 ? 31 : 21;
+    hash_.resize(nLevel_ + 1);
+    wide_.resize(nLevel_ + 1);
+    isWide_.assign(nLevel_ + 1, 0);
+    pioParallelFor(nLevel_, nThreads, [&](int64_t lm1) {
+      const int l = lm1 + 1;
+      int64_t ic[3];
+      for (int64_t i : byLevel[l]) {
+        coords(i, ic);
+        if (!packable(ic)) {
+          isWide_[l] = 1;
+          break;
+        }
+      }
+      if (isWide_[l]) {
+        auto &w = wide_[l];
+        w.reserve(byLevel[l].size());
+        for (int64_t i : byLevel[l]) {
+          coords(i, ic);
+          w[{ic[0], ic[1], ic[2]}] = i;
+        }
+        return;
+      }
+      auto &h = hash_[l];
+      h.reserve(byLevel[l].size());
+      for (int64_t i : byLevel[l]) {
+        coords(i, ic);
+        h.insert(pack(ic), i);
+      }
+    });
+  }
+
+  int nDim() const { return nDim_; }
+  int nLevel() const { return nLevel_; }
+
+  /** leaf cells at level l (1 <= l <= nLevel) in cell order **/
+  const std::vector<int64_t> &leaves(int l) const { return leaves_.at(l); }
+
+  /** Returns the leaf cell containing point p, or -1 if p is outside
+   *  the mesh.
+   **/
+  int64_t locate(const double *p) const {
+    int64_t ic[3] = {0, 0, 0};
+    for (int d = 0; d < nDim_; d++) {
+      // also rejects NaN, and keeps the conversion below defined
+      if (!(p[d] >= origin_[d] && p[d] < upper(d)))
+        return -1;
+      ic[d] = std::min<int64_t>(
+          (int64_t)floor((p[d] - origin_[d]) / width_[1][d]), n1_[d] - 1);
+    }
+    int64_t cell = find(1, ic);
+    for (int l = 1; cell >= 0 && daughter_[cell] != 0 && l < nLevel_; l++) {
+      for (int d = 0; d < nDim_; d++) {
+        double mid = origin_[d] + (ic[d] + 0.5) * width_[l][d];
+        ic[d] = 2 * ic[d] + (p[d] >= mid ? 1 : 0);
+      }
+      cell = find(l + 1, ic);
+    }
+    return cell;
+  }
+
+  /** Returns the leaf cells in the box [lo, hi), sorted by cell
+   *  index.  With overlap false (the default) a cell is selected when
+   *  its center lies in the box, otherwise when any part of it does.
+   **/
+  std::vector<int64_t> box(const double *lo, const double *hi,
+                           bool overlap = false) const {
+    std::vector<int64_t> result;
+    int64_t first[3] = {0, 0, 0}, last[3] = {0, 0, 0};
+    for (int d = 0; d < nDim_; d++) {
+      // clip the box to the domain first so that infinite bounds
+      // convert to integers safely; this also rejects NaN
+      const double a = std::max(lo[d], origin_[d]);
+      const double b = std::min(hi[d], upper(d));
+      if (!(a < b))
+        return result;
+      first[d] = (int64_t)floor((a - origin_[d]) / width_[1][d]);
+      last[d] = (int64_t)floor((b - origin_[d]) / width_[1][d]);
+      first[d] = std::max<int64_t>(first[d], 0);
+      last[d] = std::min<int64_t>(last[d], n1_[d] - 1);
+      if (last[d] < first[d])
+        return result;
+    }
+    int64_t ic[3] = {0, 0, 0};
+    for (ic[2] = first[2]; ic[2] <= last[2]; ic[2]++) {
+      for (ic[1] = first[1]; ic[1] <= last[1]; ic[1]++) {
+        for (ic[0] = first[0]; ic[0] <= last[0]; ic[0]++) {
+          int64_t cell = find(1, ic);
+          if (cell >= 0)
+            descend(cell, 1, ic, lo, hi, overlap, result);
+        }
+      }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+private:
+  /** Open addressing hash from packed coordinates to cell index **/
+  class LevelHash {
+  public:
+    void reserve(size_t n) {
+      size_t cap = 16;
+      while (cap < 2 * n)
+        cap <<= 1;
+      keys_.assign(cap, emptyKey);
+      cells_.assign(cap, -1);
+    }
+    void insert(uint64_t key, int64_t cell) {
+      size_t mask = keys_.size() - 1;
+      for (size_t s = mix(key) & mask;; s = (s + 1) & mask) {
+        if (keys_[s] == emptyKey || keys_[s] == key) {
+          keys_[s] = key;
+          cells_[s] = cell;
+          return;
+        }
+      }
+    }
+    int64_t find(uint64_t key) const {
+      if (keys_.empty())
+        return -1;
+      size_t mask = keys_.size() - 1;
+      for (size_t s = mix(key) & mask;; s = (s + 1) & mask) {
+        if (keys_[s] == key)
+          return cells_[s];
+        if (keys_[s] == emptyKey)
+          return -1;
+      }
+    }
+
+  private:
+    static constexpr uint64_t emptyKey = ~0ull;
+    std::vector<uint64_t> keys_;
+    std::vector<int64_t> cells_;
+    static uint64_t mix(uint64_t k) {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdull;
+      k ^= k >> 33;
+      return k;
+    }
+  };
+
+  int nDim_;
+  int nLevel_;
+  const std::vector<int> &level_;
+  const std::vector<int64_t> &daughter_;
+  const double *center_[3]; //< cell centers per dimension
+  double origin_[3];
+  int64_t n1_[3]; //< number of level 1 cells across the domain
+  std::vector<std::array<double, 3>> width_; //< cell width per level
+  std::vector<LevelHash> hash_;              //< per level
+  std::vector<std::vector<int64_t>> leaves_; //< leaf cells per level
+
+  struct CoordsHash {
+    size_t operator()(const std::array<int64_t, 3> &c) const {
+      uint64_t h = c[0];
+      h = h * 0x9e3779b97f4a7c15ull + c[1];
+      h = h * 0x9e3779b97f4a7c15ull + c[2];
+      return h ^ (h >> 29);
+    }
+  };
+  using WideHash =
+      std::unordered_map<std::array<int64_t, 3>, int64_t, CoordsHash>;
+  std::vector<WideHash> wide_; //< per level, used where isWide_ is set
+  std::vector<char> isWide_;   //< coordinates of the level do not pack
+  int bits_ = 21;              //< bits per packed coordinate
+
+  bool packable(const int64_t *ic) const {
+    for (int d = 0; d < nDim_; d++) {
+      if (ic[d] < 0 || ic[d] >> bits_)
+        return false;
+    }
+    return true;
+  }
+
+  // bits_ bits per coordinate, 62 or 63 bits in all
+  uint64_t pack(const int64_t *ic) const {
+    uint64_t key = 0;
+    for (int d = nDim_ - 1; d >= 0; d--)
+      key = (key << bits_) | (uint64_t)ic[d];
+    return key;
+  }
+
+  /** upper end of the domain in dimension d **/
+  double upper(int d) const { return origin_[d] + n1_[d] * width_[1][d]; }
+
+  void coords(int64_t cell, int64_t *ic) const {
+    const int l = level_[cell];
+    ic[0] = ic[1] = ic[2] = 0;
+    for (int d = 0; d < nDim_; d++) {
+      double x = (center_[d][cell] - origin_[d]) / width_[l][d];
+      ic[d] = (int64_t)floor(x);
+    }
+  }
+
+  int64_t find(int l, const int64_t *ic) const {
+    if (isWide_[l]) {
+      auto it = wide_[l].find({ic[0], ic[1], ic[2]});
+      return it == wide_[l].end() ? -1 : it->second;
+    }
+    if (!packable(ic))
+      return -1;
+    return hash_[l].find(pack(ic));
+  }
+
+  void descend(int64_t cell, int l, const int64_t *ic, const double *lo,
+               const double *hi, bool overlap,
+               std::vector<int64_t> &result) const {
+    // prune cells that do not touch the box
+    for (int d = 0; d < nDim_; d++) {
+      double cLo = origin_[d] + ic[d] * width_[l][d];
+      if (cLo >= hi[d] || cLo + width_[l][d] <= lo[d])
+        return;
+    }
+    if (daughter_[cell] == 0) {
+      bool inside = true;
+      for (int d = 0; d < nDim_ && !overlap; d++) {
+        double c = center_[d][cell];
+        inside = inside && c >= lo[d] && c < hi[d];
+      }
+      if (inside)
+        result.push_back(cell);
+      return;
+    }
+    if (l >= nLevel_)
+      return;
+    const int nChild = 1 << nDim_;
+    for (int k = 0; k < nChild; k++) {
+      int64_t jc[3] = {0, 0, 0};
+      for (int d = 0; d < nDim_; d++)
+        jc[d] = 2 * ic[d] + ((k >> d) & 1);
+      int64_t child = find(l + 1, jc);
+      if (child >= 0)
+        descend(child, l + 1, jc, lo, hi, overlap, result);
+    }
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,280 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOSTATS_HPP_
+#define PIOSTATS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** I/O counters and timings collected by PIO and PioInterface.
+ *
+ *  Instrumentation is opt-in: pass a PIOStats to the PIO or
+ *  PioInterface constructor and it records
+ *    - bytes read, number of reads, and seeks (reads that do not start
+ *      where the previous read of the same file ended),
+ *    - time spent converting doubles to other types,
+ *    - time and bytes per array read,
+ *    - time per phase (index, levels, centers, daughters, materials,
+ *      dXyz, uniqMap),
+ *  and keeps one event per array read or phase for a Chrome trace
+ *  (chrome://tracing or https://ui.perfetto.dev).  Without a PIOStats
+ *  every hook is a single null pointer test.  One PIOStats may be
+ *  shared by several readers and threads.
+ *
+ *    PIOStats stats;
+ *    PioInterface pi("run-dmp000010", 0, 0, 0, &stats);
+ *    pi.loadMesh();
+ *    std::cout << stats.json();
+ *    stats.writeChromeTrace("trace.json");
+ **/
+class PIOStats {
+public:
+  struct ArrayStats {
+    int64_t count = 0; //< number of reads of the array
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+  };
+  struct PhaseStats {
+    int64_t count = 0;
+    double seconds = 0.0;
+  };
+
+  /** At most maxEvents trace events are kept; later ones are only
+   *  counted in the totals.
+   **/
+  PIOStats(size_t maxEvents = 1 << 20)
+      : maxEvents_(maxEvents), t0_(std::chrono::steady_clock::now()) {}
+  PIOStats(const PIOStats &) = delete;
+  PIOStats &operator=(const PIOStats &) = delete;
+
+  uint64_t bytesRead() const { return bytesRead_; }
+  uint64_t reads() const { return reads_; }
+  uint64_t seeks() const { return seeks_; }
+  double convertSeconds() const { return 1e-9 * convertNs_; }
+  uint64_t droppedEvents() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+  }
+  std::map<std::string, ArrayStats> arrays() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return arrays_;
+  }
+  std::map<std::string, PhaseStats> phases() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return phases_;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytesRead_ = reads_ = seeks_ = convertNs_ = 0;
+    events_.clear();
+    arrays_.clear();
+    phases_.clear();
+    dropped_ = 0;
+    t0_ = std::chrono::steady_clock::now();
+  }
+
+  /** Totals, per-phase and per-array statistics as a JSON object **/
+  std::string json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream s;
+    s.precision(9);
+    s << "{\n  \"bytesRead\": " << bytesRead_ << ",\n  \"reads\": " << reads_
+      << ",\n  \"seeks\": " << seeks_
+      << ",\n  \"convertSeconds\": " << 1e-9 * convertNs_
+      << ",\n  \"droppedEvents\": " << dropped_ << ",\n  \"phases\": {";
+    const char *sep = "\n";
+    for (auto &p : phases_) {
+      s << sep << "    " << quote(p.first) << ": {\"count\": "
+        << p.second.count << ", \"seconds\": " << p.second.seconds << "}";
+      sep = ",\n";
+    }
+    s << "\n  },\n  \"arrays\": {";
+    sep = "\n";
+    for (auto &a : arrays_) {
+      s << sep << "    " << quote(a.first) << ": {\"count\": "
+        << a.second.count << ", \"bytes\": " << a.second.bytes
+        << ", \"seconds\": " << a.second.seconds << "}";
+      sep = ",\n";
+    }
+    s << "\n  }\n}\n";
+    return s.str();
+  }
+
+  bool writeJson(const std::string &filename) const {
+    return writeFile(filename, json());
+  }
+
+  /** Writes the recorded events in the Chrome trace event format **/
+  bool writeChromeTrace(const std::string &filename) const {
+    std::ostringstream s;
+    s.precision(3);
+    s << std::fixed << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const char *sep = "\n";
+      for (auto &e : events_) {
+        s << sep << "{\"name\": " << quote(e.name) << ", \"cat\": \""
+          << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid
+          << ", \"ts\": " << e.start << ", \"dur\": " << e.duration;
+        if (e.bytes)
+          s << ", \"args\": {\"bytes\": " << e.bytes << "}";
+        s << "}";
+        sep = ",\n";
+      }
+    }
+    s << "\n]}\n";
+    return writeFile(filename, s.str());
+  }
+
+  /** Times a phase (category "phase"), an index step ("index") or an
+   *  array read ("array") from construction to destruction.  Does
+   *  nothing if stats is null.
+   **/
+  class Scope {
+  public:
+    Scope(PIOStats *stats, const char *category, const char *name)
+        : stats_(stats), category_(category) {
+      if (stats_) {
+        name_ = name;
+        start_ = std::chrono::steady_clock::now();
+      }
+    }
+    Scope(PIOStats *stats, const char *category, const std::string &name)
+        : stats_(stats), category_(category) {
+      if (stats_) {
+        name_ = name;
+        start_ = std::chrono::steady_clock::now();
+      }
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() {
+      if (stats_)
+        stats_->record(category_, name_, start_,
+                       std::chrono::steady_clock::now(), bytes_);
+    }
+    void addBytes(uint64_t n) { bytes_ += n; }
+
+  private:
+    PIOStats *stats_;
+    const char *category_;
+    std::string name_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t bytes_ = 0;
+  };
+
+  // hooks used by the readers
+
+  void countRead(uint64_t bytes, bool seek) {
+    bytesRead_ += bytes;
+    reads_++;
+    if (seek)
+      seeks_++;
+  }
+  void countMapped(uint64_t bytes) { bytesRead_ += bytes; }
+  void addConvertTime(std::chrono::steady_clock::duration d) {
+    convertNs_ +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+private:
+  struct Event {
+    std::string name;
+    const char *category;
+    int tid;
+    double start;    //< [us] since construction or reset()
+    double duration; //< [us]
+    uint64_t bytes;
+  };
+
+  std::atomic<uint64_t> bytesRead_{0};
+  std::atomic<uint64_t> reads_{0};
+  std::atomic<uint64_t> seeks_{0};
+  std::atomic<uint64_t> convertNs_{0};
+  mutable std::mutex mutex_; //< guards everything below
+  size_t maxEvents_;
+  uint64_t dropped_ = 0;
+  std::chrono::steady_clock::time_point t0_;
+  std::vector<Event> events_;
+  std::map<std::string, ArrayStats> arrays_;
+  std::map<std::string, PhaseStats> phases_;
+  std::map<std::thread::id, int> tids_; //< small ids for the trace
+
+  void record(const char *category, const std::string &name,
+              std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::time_point end, uint64_t bytes) {
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!strcmp(category, "array")) {
+      auto &a = arrays_[name];
+      a.count++;
+      a.bytes += bytes;
+      a.seconds += seconds;
+    } else {
+      auto &p = phases_[name];
+      p.count++;
+      p.seconds += seconds;
+    }
+    if (events_.size() >= maxEvents_) {
+      dropped_++;
+      return;
+    }
+    auto tid = tids_.emplace(std::this_thread::get_id(), tids_.size()).first;
+    events_.push_back(
+        {name, category, tid->second,
+         1e6 * std::chrono::duration<double>(start - t0_).count(),
+         1e6 * seconds, bytes});
+  }
+
+  static std::string quote(const std::string &s) {
+    std::string q = "\"";
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        q += '\\';
+        q += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char u[8];
+        snprintf(u, sizeof(u), "\\u%04x", c);
+        q += u;
+      } else {
+        q += c;
+      }
+    }
+    return q + "\"";
+  }
+
+  static bool writeFile(const std::string &filename, const std::string &s) {
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (!fp)
+      return false;
+    bool ok = fwrite(s.data(), 1, s.size(), fp) == s.size();
+    return (fclose(fp) == 0) && ok;
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,128 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOSTREAM_HPP_
+#define PIOSTREAM_HPP_
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "pio.hpp"
+
+/** Cells [start, start + count) of a set of arrays.  data[i] holds
+ *  the slice of the i-th array requested from PIOBlockReader, count
+ *  values long.
+ **/
+struct PIOCellBlock {
+  int64_t start = 0;
+  int64_t count = 0;
+  std::vector<std::vector<double>> data;
+  const std::vector<double> &operator[](size_t i) const { return data[i]; }
+};
+
+/** Streams a set of cell arrays in blocks of blockSize cells.
+ *
+ *  While the caller works on one block the next one is read in the
+ *  background, so at most two blocks are ever held in memory:
+ *
+ *    PIOBlockReader r(pio, {"pres_0", "vcell_0"}, 1 << 20);
+ *    PIOCellBlock b;
+ *    while (r.next(b)) {
+ *      for (int64_t i = 0; i < b.count; i++)
+ *        use(b.start + i, b[0][i], b[1][i]);
+ *    }
+ *
+ *  The cell range defaults to [0, numcell) and can be narrowed with
+ *  start and end.  If an array is missing or a slice cannot be read
+ *  in full, next() returns false and failed() is set, so every block
+ *  handed out is complete.  For one pass over a dump larger than
+ *  memory, set PIO::setStreamMode() first to keep it out of the page
+ *  cache.
+ **/
+class PIOBlockReader {
+public:
+  PIOBlockReader(PIO &pio, std::vector<std::string> names,
+                 int64_t blockSize = 1 << 20, int64_t start = 0,
+                 int64_t end = -1)
+      : pio_(pio), names_(names), blockSize_(std::max<int64_t>(1, blockSize)),
+        next_(start), end_(end < 0 ? pio.numcell() : end) {
+    prefetch();
+  }
+  PIOBlockReader(const PIOBlockReader &) = delete;
+  PIOBlockReader &operator=(const PIOBlockReader &) = delete;
+  ~PIOBlockReader() {
+    if (pending_.valid())
+      pending_.wait();
+  }
+
+  int64_t blockSize() { return blockSize_; }
+  bool failed() { return failed_; } //< next() stopped on a short read
+  const std::vector<std::string> &names() { return names_; }
+
+  /** Hands the next block to the caller and starts reading the one
+   *  after it.  The buffers previously held by block are recycled.
+   *  Returns false once all cells have been delivered or a read
+   *  failed.
+   **/
+  bool next(PIOCellBlock &block) {
+    if (!pending_.valid())
+      return false;
+    failed_ = !pending_.get();
+    if (buffer_.count == 0 || failed_)
+      return false;
+    std::swap(block, buffer_);
+    prefetch();
+    return true;
+  }
+
+private:
+  PIO &pio_;
+  std::vector<std::string> names_;
+  int64_t blockSize_;
+  int64_t next_; //< first cell of the block to be read next
+  int64_t end_;
+  PIOCellBlock buffer_;       //< block being filled in the background
+  std::future<bool> pending_; //< read of buffer_, false if short
+  bool failed_ = false;
+
+  void prefetch() {
+    buffer_.start = next_;
+    buffer_.count = std::max<int64_t>(0, std::min(blockSize_, end_ - next_));
+    next_ += buffer_.count;
+    if (buffer_.count == 0) {
+      // nothing left, hand out an empty block without a thread
+      std::promise<bool> done;
+      done.set_value(true);
+      pending_ = done.get_future();
+      return;
+    }
+    pending_ = std::async(std::launch::async, [this]() {
+      buffer_.data.resize(names_.size());
+      for (size_t i = 0; i < names_.size(); i++) {
+        auto &d = buffer_.data[i];
+        d.resize(buffer_.count);
+        if (pio_.readArrayRangeInto(names_[i], buffer_.start, buffer_.count,
+                                    d.data()) != buffer_.count)
+          return false;
+      }
+      return true;
+    });
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,271 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOSYNTHETIC_HPP_
+#define PIOSYNTHETIC_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pio.hpp"
+
+/** Shape of a synthetic dump **/
+struct PioSyntheticConfig {
+  int nDim = 3;
+  int64_t nCell = 1 << 20; //< approximate number of cells
+  int nLevel = 4;          //< number of AMR levels
+  int nMat = 4;            //< number of materials
+  int matsPerCell = 2;     //< each cell holds 1..matsPerCell materials
+  int nCellArrays = 8;     //< cell arrays besides the mesh (cellvar_i)
+  int nSmallArrays = 0;    //< one-value arrays (scalar_i), to grow the index
+  uint64_t seed = 1;
+};
+
+/** Writes valid PIO files with a random AMR mesh and random data, for
+ *  benchmarks and tests.
+ *
+ *  The level 1 mesh is a regular grid over the unit cube laid out in
+ *  blocks of 2^nDim cells, so that cells 1, 2 and 4 are the x, y and z
+ *  neighbors of cell 0 as PioInterface expects.  Random leaves of each
+ *  level are then refined until there are about nCell cells; the
+ *  daughters of a cell are stored together, first daughter in
+ *  cell_daughter (1-based).  Material data is in the usual
+ *  chunk_nummat / chunk_mat / chunk_vol / chunk_eng layout with
+ *  matdef giving the number of materials.  The same config and seed
+ *  always produce the same file.
+ **/
+class PioSynthetic {
+public:
+  PioSynthetic(const PioSyntheticConfig &config = PioSyntheticConfig())
+      : config_(config), rng_(config.seed) {
+    config_.nDim = std::max(1, std::min(config_.nDim, 3));
+    config_.nLevel = std::max(1, config_.nLevel);
+    config_.nMat = std::max(1, config_.nMat);
+    config_.matsPerCell =
+        std::max(1, std::min(config_.matsPerCell, config_.nMat));
+    buildMesh();
+    buildMaterials();
+  }
+
+  int64_t nCell() const { return level_.size(); }
+  int64_t csrLength() const { return mats_.size(); }
+  const PioSyntheticConfig &config() const { return config_; }
+
+  /** Writes the dump, returning false on any I/O error **/
+  bool write(const std::string &filename, bool verbose = false) {
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+      std::cout << "Unable to open file " << filename << std::endl;
+      return false;
+    }
+    index_.clear();
+    position_ = lengthHeader;
+    std::vector<char> header(8 * lengthHeader, '\0');
+    bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size();
+
+    const int nDim = config_.nDim;
+    const int64_t n = nCell();
+    std::vector<double> v(n);
+    for (int d = 0; d < nDim && ok; d++)
+      ok = writeArray(fp, "cell_center", d + 1, center_[d]);
+    std::copy(level_.begin(), level_.end(), v.begin());
+    ok = ok && writeArray(fp, "cell_level", 0, v);
+    std::copy(daughter_.begin(), daughter_.end(), v.begin());
+    ok = ok && writeArray(fp, "cell_daughter", 0, v);
+    std::vector<double> vcell(n);
+    for (int64_t i = 0; i < n; i++)
+      vcell[i] = pow(width(level_[i]), nDim);
+    ok = ok && writeArray(fp, "vcell", 0, vcell);
+    ok = ok && writeArray(fp, "pres", 0, random(n));
+    for (int i = 1; i <= config_.nCellArrays && ok; i++)
+      ok = writeArray(fp, "cellvar", i, random(n));
+
+    // material data, volume fractions of each cell add up to one
+    std::copy(nummat_.begin(), nummat_.end(), v.begin());
+    ok = ok && writeArray(fp, "chunk_nummat", 0, v);
+    std::vector<double> c(mats_.begin(), mats_.end());
+    ok = ok && writeArray(fp, "chunk_mat", 0, c);
+    std::uniform_real_distribution<double> u(0.1, 1.0);
+    for (int64_t i = 0, k = 0; i < n; i++) {
+      double sum = 0.0;
+      for (int j = 0; j < nummat_[i]; j++)
+        sum += (c[k + j] = u(rng_));
+      for (int j = 0; j < nummat_[i]; j++, k++)
+        c[k] *= vcell[i] / sum;
+    }
+    ok = ok && writeArray(fp, "chunk_vol", 0, c);
+    ok = ok && writeArray(fp, "chunk_eng", 0, random(c.size()));
+    for (int m = 1; m <= config_.nMat && ok; m++)
+      ok = writeArray(fp, "matdef", m, {double(m), 1.0});
+    ok = ok && writeArray(fp, "hist_cycle", 0, {1.0});
+    for (int i = 1; i <= config_.nSmallArrays && ok; i++)
+      ok = writeArray(fp, "scalar", i, {double(i)});
+
+    // index, then the header now that the index position is known
+    ok = ok && fwrite(index_.data(), 1, index_.size(), fp) == index_.size();
+    PIOHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.filetype, "pio_file", 8);
+    h.two = 2.0;
+    h.version = 1.0;
+    h.lengthName = lengthName;
+    h.lengthHeader = lengthHeader;
+    h.lengthIndex = lengthIndex;
+    memcpy(h.date, "synthetic dump  ", 16);
+    h.nArrays = index_.size() / (8 * lengthIndex);
+    h.position = position_;
+    h.signature = 7.0;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (verbose) {
+      std::cout << "Wrote " << filename << ": " << n << " cells, "
+                << csrLength() << " material entries, " << h.nArrays
+                << " arrays" << std::endl;
+    }
+    return ok;
+  }
+
+private:
+  static constexpr int lengthName = 32;
+  static constexpr int lengthHeader = 16; //< [doubles]
+  static constexpr int lengthIndex = 8;   //< [doubles]
+
+  PioSyntheticConfig config_;
+  std::mt19937_64 rng_;
+  std::vector<int> level_;
+  std::vector<int64_t> daughter_;
+  std::vector<double> center_[3];
+  std::vector<int> nummat_;
+  std::vector<int> mats_;
+  std::vector<char> index_;
+  int64_t position_ = 0; //< where the next array goes [doubles]
+  double w1_ = 1.0;      //< width of a level 1 cell
+
+  double width(int l) const { return w1_ / double(int64_t(1) << (l - 1)); }
+
+  std::vector<double> random(size_t n) {
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    std::vector<double> r(n);
+    for (auto &x : r)
+      x = u(rng_);
+    return r;
+  }
+
+  bool writeArray(FILE *fp, const std::string &name, int index,
+                  const std::vector<double> &data) {
+    std::vector<char> entry(8 * lengthIndex, '\0');
+    memset(entry.data(), ' ', lengthName);
+    memcpy(entry.data(), name.data(),
+           std::min<size_t>(name.size(), lengthName));
+    double v[3] = {double(index), double(data.size()), double(position_)};
+    memcpy(entry.data() + lengthName, v, sizeof(v));
+    index_.insert(index_.end(), entry.begin(), entry.end());
+    position_ += data.size();
+    return fwrite(data.data(), sizeof(double), data.size(), fp) == data.size();
+  }
+
+  void addCell(int l, const double *c) {
+    level_.push_back(l);
+    daughter_.push_back(0);
+    for (int d = 0; d < config_.nDim; d++)
+      center_[d].push_back(c[d]);
+  }
+
+  void buildMesh() {
+    const int nDim = config_.nDim;
+    const int nChild = 1 << nDim;
+    const int64_t target = std::max<int64_t>(nChild, config_.nCell);
+
+    // level 1: an even number of cells per dimension, in 2^nDim blocks
+    const int64_t target1 = config_.nLevel == 1 ? target : target / 2;
+    int64_t n1 = 2;
+    while (pow(double(n1 + 2), nDim) <= double(target1))
+      n1 += 2;
+    w1_ = 1.0 / n1;
+    const int64_t nb = n1 / 2;
+    const int64_t nBlock[3] = {nb, nDim > 1 ? nb : 1, nDim > 2 ? nb : 1};
+    for (int64_t bz = 0; bz < nBlock[2]; bz++) {
+      for (int64_t by = 0; by < nBlock[1]; by++) {
+        for (int64_t bx = 0; bx < nBlock[0]; bx++) {
+          const int64_t b[3] = {bx, by, bz};
+          for (int o = 0; o < nChild; o++) {
+            double c[3];
+            for (int d = 0; d < nDim; d++)
+              c[d] = (2 * b[d] + ((o >> d) & 1) + 0.5) * w1_;
+            addCell(1, c);
+          }
+        }
+      }
+    }
+
+    // refine random leaves, spreading the refinements over the levels
+    int64_t remaining = std::max<int64_t>(0, target - nCell()) / nChild;
+    std::vector<int64_t> candidates;
+    for (int64_t i = 0; i < nCell(); i++)
+      candidates.push_back(i);
+    for (int l = 1; l < config_.nLevel && remaining > 0; l++) {
+      int64_t r = (remaining + config_.nLevel - l - 1) / (config_.nLevel - l);
+      r = std::min<int64_t>(r, candidates.size());
+      for (int64_t i = 0; i < r; i++) {
+        std::uniform_int_distribution<int64_t> pick(i, candidates.size() - 1);
+        std::swap(candidates[i], candidates[pick(rng_)]);
+      }
+      candidates.resize(r);
+      std::sort(candidates.begin(), candidates.end());
+      remaining -= r;
+
+      std::vector<int64_t> children;
+      const double h = 0.25 * width(l);
+      for (int64_t p : candidates) {
+        daughter_[p] = nCell() + 1;
+        for (int o = 0; o < nChild; o++) {
+          double c[3];
+          for (int d = 0; d < nDim; d++)
+            c[d] = center_[d][p] + (((o >> d) & 1) ? h : -h);
+          children.push_back(nCell());
+          addCell(l + 1, c);
+        }
+      }
+      candidates.swap(children);
+    }
+  }
+
+  void buildMaterials() {
+    const int nMat = config_.nMat;
+    std::uniform_int_distribution<int> count(1, config_.matsPerCell);
+    std::uniform_int_distribution<int> first(0, nMat - 1);
+    std::vector<int> m;
+    nummat_.resize(nCell());
+    for (int64_t i = 0; i < nCell(); i++) {
+      // k consecutive material ids (mod nMat) from a random start
+      const int k = count(rng_), s = first(rng_);
+      m.clear();
+      for (int j = 0; j < k; j++)
+        m.push_back((s + j) % nMat + 1);
+      std::sort(m.begin(), m.end());
+      nummat_[i] = k;
+      mats_.insert(mats_.end(), m.begin(), m.end());
+    }
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,447 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOURING_HPP_
+#define PIOURING_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pio.hpp"
+
+// Define PIO_HAVE_IO_URING to 0 to build with pread() only
+#ifndef PIO_HAVE_IO_URING
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#if defined(__NR_io_uring_setup) && defined(IORING_OFF_SQES)
+#define PIO_HAVE_IO_URING 1
+#else
+#define PIO_HAVE_IO_URING 0
+#endif
+#endif
+
+/** One range read of PIOUringReader::read() **/
+struct PIOReadRequest {
+  std::string name;      //< array, e.g. pres_0
+  int64_t start = 0;     //< first element
+  int64_t count = -1;    //< elements, clipped to the array; -1 to the end
+  double *out = nullptr; //< room for count elements
+  int64_t read = 0;      //< elements read, set by read()
+};
+
+/** Reads many arrays, ranges or gathered elements of a PIO dump with
+ *  one io_uring: up to queueDepth reads are in flight at once, so a
+ *  batch costs a few system calls rather than one per read.
+ *
+ *    PIO pio("run-dmp000100");
+ *    PIOUringReader reader(pio, 64);
+ *    auto arrays = reader.readArrays({"pres_0", "rho_0", "tev_0"});
+ *    auto picked = reader.readArrayGather("pres_0", sortedCells);
+ *
+ *  Ranges are split into reads of at most bufferBytes that go straight
+ *  into the caller's memory.  Gathers are split into runs of nearby
+ *  elements, as in PIO::readArrayGather(), that are read into
+ *  queueDepth buffers registered with the kernel once, and picked out
+ *  of them as the reads complete.
+ *
+ *  Where io_uring is not available (other systems, old kernels, or a
+ *  seccomp profile that blocks it) the same calls fall back to
+ *  pread().  A reader is not thread-safe; use one per thread.
+ **/
+class PIOUringReader {
+public:
+  PIOUringReader(PIO &pio, unsigned queueDepth = 32,
+                 size_t bufferBytes = 1 << 20)
+      : pio_(pio), depth_(std::max(1u, std::min(queueDepth, 4096u))),
+        bufferBytes_(std::max<size_t>(
+            4096, std::min<size_t>(bufferBytes, 1 << 30) & ~size_t(4095))) {
+    setup();
+  }
+  PIOUringReader(const PIOUringReader &) = delete;
+  PIOUringReader &operator=(const PIOUringReader &) = delete;
+  ~PIOUringReader() { teardown(); }
+
+  /** true if reads go through io_uring rather than pread() **/
+  bool available() const { return ringFd_ >= 0; }
+  /** true if the gather buffers are registered with the kernel **/
+  bool fixedBuffers() const { return fixed_; }
+  unsigned queueDepth() const { return depth_; }
+
+  /** Reads every request; sets request.read to the number of elements
+   *  read and returns the total.
+   **/
+  int64_t read(std::vector<PIOReadRequest> &requests) {
+    std::vector<Piece> pieces;
+    for (size_t r = 0; r < requests.size(); r++) {
+      PIOReadRequest &q = requests[r];
+      q.read = 0;
+      auto it = pio_.arrays.find(q.name);
+      if (it == pio_.arrays.end() || q.start < 0 || !q.out)
+        continue;
+      const int64_t length = int64_t(it->second.length);
+      const int64_t count =
+          std::min(q.count < 0 ? length : q.count, length - q.start);
+      const uint64_t base = 8 * (uint64_t(it->second.position) + q.start);
+      const uint64_t bytes = count > 0 ? 8 * uint64_t(count) : 0;
+      for (uint64_t b = 0; b < bytes; b += bufferBytes_) {
+        const uint32_t n = std::min<uint64_t>(bufferBytes_, bytes - b);
+        pieces.push_back({base + b, reinterpret_cast<char *>(q.out) + b, n,
+                          0, int64_t(r), -1});
+      }
+    }
+    std::vector<uint64_t> bytesRead(requests.size(), 0);
+    run(pieces, false, [&](const Piece &p) { bytesRead[p.tag] += p.done; });
+    int64_t total = 0;
+    for (size_t r = 0; r < requests.size(); r++) {
+      requests[r].read = bytesRead[r] / sizeof(double);
+      total += requests[r].read;
+    }
+    return total;
+  }
+
+  /** Reads whole arrays; missing arrays come back empty **/
+  std::vector<std::vector<double>>
+  readArrays(const std::vector<std::string> &names) {
+    std::vector<std::vector<double>> result(names.size());
+    std::vector<PIOReadRequest> requests(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      auto it = pio_.arrays.find(names[i]);
+      if (it == pio_.arrays.end())
+        continue;
+      result[i].resize(it->second.length);
+      requests[i].name = names[i];
+      requests[i].out = result[i].data();
+    }
+    read(requests);
+    for (size_t i = 0; i < names.size(); i++)
+      result[i].resize(requests[i].read);
+    return result;
+  }
+
+  /** Same as PIO::readArrayGather(): reads the elements of an array at
+   *  the given ascending indices, merging indices closer than maxGap
+   *  elements apart into one read.  Empty if the indices are not
+   *  sorted or out of range, or a read comes up short.
+   **/
+  std::vector<double> readArrayGather(const std::string &name,
+                                      const std::vector<int64_t> &indices,
+                                      int64_t maxGap = 512) {
+    std::vector<double> v;
+    auto it = pio_.arrays.find(name);
+    if (it == pio_.arrays.end() || indices.empty())
+      return v;
+    const int64_t length = int64_t(it->second.length);
+    // sorted indices keep every run within one buffer slot
+    if (indices.front() < 0 || indices.back() >= length ||
+        !std::is_sorted(indices.begin(), indices.end()))
+      return v;
+    v.resize(indices.size());
+
+    // runs of nearby indices, each fitting in one buffer; tag is the
+    // first index of the run
+    const uint64_t base = 8 * uint64_t(it->second.position);
+    const int64_t maxRun = bufferBytes_ / sizeof(double);
+    std::vector<Piece> pieces;
+    std::vector<int64_t> runEnd;
+    for (size_t k = 0; k < indices.size();) {
+      const int64_t first = indices[k];
+      size_t kEnd = k + 1;
+      while (kEnd < indices.size() &&
+             indices[kEnd] - indices[kEnd - 1] <= maxGap &&
+             indices[kEnd] - first < maxRun)
+        kEnd++;
+      const uint32_t n = 8 * (indices[kEnd - 1] - first + 1);
+      pieces.push_back({base + 8 * uint64_t(first), nullptr, n, 0,
+                        int64_t(k), -1});
+      runEnd.push_back(kEnd);
+      k = kEnd;
+    }
+    bool ok = true;
+    size_t completed = 0;
+    run(pieces, true, [&](const Piece &p) {
+      completed++;
+      if (p.done < p.bytes) {
+        ok = false;
+        return;
+      }
+      const double *run = reinterpret_cast<const double *>(p.dst);
+      const int64_t first = indices[p.tag];
+      const int64_t end = runEnd[&p - pieces.data()];
+      for (int64_t k = p.tag; k < end; k++)
+        v[k] = run[indices[k] - first];
+    });
+    if (!ok || completed != pieces.size())
+      v.clear();
+    return v;
+  }
+
+private:
+  /** A read of bytes at byte offset into dst, or into a buffer slot if
+   *  dst is null
+   **/
+  struct Piece {
+    uint64_t offset;
+    char *dst;
+    uint32_t bytes;
+    uint32_t done; //< bytes read so far
+    int64_t tag;   //< meaning up to the caller
+    int slot;      //< buffer slot while in flight, -1 if none
+  };
+
+  PIO &pio_;
+  unsigned depth_;
+  size_t bufferBytes_;
+  int ringFd_ = -1;
+  bool fixed_ = false;
+  char *buffers_ = nullptr; //< depth_ slots of bufferBytes_ each
+#if PIO_HAVE_IO_URING
+  void *sqRing_ = nullptr, *cqRing_ = nullptr;
+  size_t sqRingBytes_ = 0, cqRingBytes_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  unsigned *sqHead_ = nullptr, *sqTail_ = nullptr, *sqMask_ = nullptr;
+  unsigned *sqArray_ = nullptr;
+  unsigned *cqHead_ = nullptr, *cqTail_ = nullptr, *cqMask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+#endif
+
+  /** Allocates the buffer slots and sets up the ring; leaves
+   *  ringFd_ at -1 if io_uring cannot be used
+   **/
+  void setup() {
+    void *b = nullptr;
+    if (posix_memalign(&b, 4096, depth_ * bufferBytes_) != 0)
+      return;
+    buffers_ = static_cast<char *>(b);
+#if PIO_HAVE_IO_URING
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    const int fd = syscall(__NR_io_uring_setup, depth_, &p);
+    if (fd < 0)
+      return;
+    sqRingBytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingBytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+      sqRingBytes_ = cqRingBytes_ = std::max(sqRingBytes_, cqRingBytes_);
+    sqRing_ = mmap(nullptr, sqRingBytes_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqRing_ = single ? sqRing_
+                     : mmap(nullptr, cqRingBytes_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+    if (sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED ||
+        sqes == MAP_FAILED) {
+      if (sqes != MAP_FAILED)
+        munmap(sqes, p.sq_entries * sizeof(io_uring_sqe));
+      ringFd_ = fd;
+      teardown();
+      return;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+    char *sq = static_cast<char *>(sqRing_), *cq = static_cast<char *>(cqRing_);
+    sqHead_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    ringFd_ = fd;
+    depth_ = std::min(depth_, p.sq_entries);
+
+    // registering the slots saves pinning their pages on every read;
+    // without it (e.g. a low RLIMIT_MEMLOCK) plain reads are used
+    std::vector<iovec> iov(depth_);
+    for (unsigned s = 0; s < depth_; s++)
+      iov[s] = {buffers_ + s * bufferBytes_, bufferBytes_};
+    fixed_ = syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS,
+                     iov.data(), depth_) == 0;
+#endif
+  }
+
+  void teardown() {
+#if PIO_HAVE_IO_URING
+    if (sqes_)
+      munmap(sqes_, (*sqMask_ + 1) * sizeof(io_uring_sqe));
+    if (cqRing_ && cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+      munmap(cqRing_, cqRingBytes_);
+    if (sqRing_ && sqRing_ != MAP_FAILED)
+      munmap(sqRing_, sqRingBytes_);
+    sqes_ = nullptr;
+    sqRing_ = cqRing_ = nullptr;
+#endif
+    if (ringFd_ >= 0)
+      close(ringFd_);
+    ringFd_ = -1;
+    fixed_ = false;
+    free(buffers_);
+    buffers_ = nullptr;
+  }
+
+  /** Reads every piece, into a buffer slot if staged, and calls
+   *  complete(piece) once each is done, with piece.dst pointing at the
+   *  data and piece.done the bytes read.
+   **/
+  template <typename F>
+  void run(std::vector<Piece> &pieces, bool staged, F complete) {
+    PIOStats *stats = pio_.stats();
+    PIOStats::Scope scope(stats, "phase", "uringRead");
+    const int fd = pio_.fd();
+    if (fd < 0 || (staged && !buffers_))
+      return;
+    if (stats) {
+      uint64_t end = ~0ull;
+      for (auto &p : pieces) {
+        stats->countRead(p.bytes, p.offset != end);
+        end = p.offset + p.bytes;
+      }
+    }
+#if PIO_HAVE_IO_URING
+    if (ringFd_ >= 0) {
+      ringRun(pieces, staged, complete);
+      return;
+    }
+#endif
+    for (auto &p : pieces) {
+      if (staged)
+        p.dst = buffers_;
+      p.done = PIO::preadFull(fd, p.offset, p.bytes, p.dst);
+      complete(p);
+    }
+  }
+
+#if PIO_HAVE_IO_URING
+  template <typename F>
+  void ringRun(std::vector<Piece> &pieces, bool staged, F complete) {
+    const int fd = pio_.fd();
+    std::vector<int> freeSlots;
+    for (int s = depth_ - 1; s >= 0; s--)
+      freeSlots.push_back(s);
+    std::vector<size_t> retry; //< pieces to submit again
+    std::vector<char> finished(pieces.size(), 0);
+    size_t next = 0, inFlight = 0;
+    unsigned toSubmit = 0;
+    auto finish = [&](Piece &p) {
+      complete(p);
+      finished[&p - pieces.data()] = 1;
+      if (p.slot >= 0)
+        freeSlots.push_back(p.slot);
+      p.slot = -1;
+    };
+    while (next < pieces.size() || inFlight > 0 || !retry.empty()) {
+      // queue reads while there is room
+      unsigned tail = *sqTail_;
+      while (inFlight < depth_ && (!retry.empty() || next < pieces.size())) {
+        size_t i;
+        if (!retry.empty()) {
+          i = retry.back();
+          retry.pop_back();
+        } else {
+          i = next++;
+          if (staged) {
+            pieces[i].slot = freeSlots.back();
+            freeSlots.pop_back();
+            pieces[i].dst = buffers_ + pieces[i].slot * bufferBytes_;
+          }
+        }
+        Piece &p = pieces[i];
+        io_uring_sqe &e = sqes_[tail & *sqMask_];
+        memset(&e, 0, sizeof(e));
+        e.opcode = staged && fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        e.fd = fd;
+        e.off = p.offset + p.done;
+        e.addr = reinterpret_cast<uint64_t>(p.dst + p.done);
+        e.len = p.bytes - p.done;
+        e.buf_index = staged && fixed_ ? p.slot : 0;
+        e.user_data = i;
+        sqArray_[tail & *sqMask_] = tail & *sqMask_;
+        tail++;
+        toSubmit++;
+        inFlight++;
+      }
+      __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+      const int r = syscall(__NR_io_uring_enter, ringFd_, toSubmit, 1,
+                            IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r >= 0) {
+        toSubmit -= std::min<unsigned>(toSubmit, r);
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        std::cout << "io_uring_enter failed, falling back to pread"
+                  << std::endl;
+        ringFailed(pieces, staged, finished, complete);
+        return;
+      }
+
+      // reap completions
+      unsigned head = *cqHead_;
+      const unsigned cqTail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+      for (; head != cqTail; head++) {
+        const io_uring_cqe &c = cqes_[head & *cqMask_];
+        Piece &p = pieces[c.user_data];
+        inFlight--;
+        if (c.res == -EINTR || c.res == -EAGAIN) {
+          retry.push_back(c.user_data);
+        } else if (c.res > 0 && p.done + c.res < p.bytes) {
+          p.done += c.res; // short read, ask for the rest
+          retry.push_back(c.user_data);
+        } else {
+          if (c.res > 0)
+            p.done += c.res;
+          finish(p);
+        }
+      }
+      __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    }
+  }
+
+  /** Rereads every unfinished piece with pread() after the ring
+   *  broke, then drops the ring so that later calls use pread().
+   *  Staged pieces go through a buffer of their own since reads still
+   *  queued in the kernel may land in the slots.
+   **/
+  template <typename F>
+  void ringFailed(std::vector<Piece> &pieces, bool staged,
+                  const std::vector<char> &finished, F complete) {
+    const int fd = pio_.fd();
+    std::vector<char> buffer(staged ? bufferBytes_ : 0);
+    for (size_t i = 0; i < pieces.size(); i++) {
+      if (finished[i])
+        continue;
+      Piece &p = pieces[i];
+      if (staged)
+        p.dst = buffer.data();
+      p.done = PIO::preadFull(fd, p.offset, p.bytes, p.dst);
+      complete(p);
+    }
+    teardown();
+  }
+#endif
+};
+
+#endif
+
+// END
@@ -0,0 +1,263 @@
+//========================================================================================
+// (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+//
+// This program was produced under U.S. Government contract 89233218CNA000001
+// for Los Alamos National Laboratory (LANL), which is operated by Triad
+// National Security, LLC for the U.S. Department of Energy/National Nuclear
+// Security Administration. All rights in the program are reserved by Triad
+// National Security, LLC, and the U.S. Department of Energy/National Nuclear
+// Security Administration. The Government is granted for itself and others
+// acting on its behalf a nonexclusive, paid-up, irrevocable worldwide license
+// in this material to reproduce, prepare derivative works, distribute copies to
+// the public, perform publicly and display publicly, and to permit others to do
+// so.
+//========================================================================================
+
+#ifndef PIOWRITER_HPP_
+#define PIOWRITER_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+#include "pio.hpp"
+
+/** Appends arrays to an existing PIO file in place.
+ *
+ *  New array data is written after the end of the file, then commit()
+ *  writes the old index followed by the entries of the new arrays
+ *  after it and, once those are on disk, patches nArrays and the index
+ *  position in the header with a single write.  The committed index is
+ *  never overwritten, so a crash at any point leaves a valid dump: the
+ *  old one before the header write, the new one after it.  Each commit
+ *  leaves the previous index behind as unused bytes.  The cost is
+ *  proportional to the new data only.  To keep the
+ *  original dump untouched, clone() it first; on file systems that
+ *  support it the clone shares blocks with the original (reflink),
+ *  otherwise it is copied in the kernel with copy_file_range.
+ *
+ *    PioWriter::clone("run-dmp000010", "new-dmp000010");
+ *    PioWriter w("new-dmp000010");
+ *    w.appendArray("processor_id", procId.data(), procId.size());
+ *    w.commit();
+ *
+ *  If the writer is destroyed without a commit the file is truncated
+ *  to its old size.  PIO objects opened on the file before the commit
+ *  do not see the new arrays.
+ **/
+class PioWriter {
+public:
+  PioWriter(const std::string &filename, bool verbose = false)
+      : verbose_(verbose), good_(false), inArray_(false), dirty_(false) {
+    fd_ = open(filename.c_str(), O_RDWR);
+    if (fd_ < 0) {
+      std::cout << "Unable to open file " << filename << std::endl;
+      return;
+    }
+    if (PIO::preadFull(fd_, 0, sizeof(PIOHeader), &header_) !=
+            sizeof(PIOHeader) ||
+        strncmp(header_.filetype, "pio_file", 8) || header_.two != 2.0) {
+      std::cout << "Unable to open file" << std::endl;
+      return;
+    }
+    lName_ = static_cast<size_t>(header_.lengthName);
+    lEntry_ = 8 * static_cast<size_t>(header_.lengthIndex);
+    oldIndex_ = PIO::readIndexBlock(fd_, header_);
+    if (oldIndex_.size() != static_cast<size_t>(header_.nArrays) * lEntry_ ||
+        lEntry_ < lName_ + 3 * sizeof(double)) {
+      std::cout << "Unable to read index" << std::endl;
+      return;
+    }
+    struct stat st;
+    fstat(fd_, &st);
+    oldSize_ = st.st_size;
+    end_ = (oldSize_ + 7) / 8;
+    good_ = true;
+  }
+  PioWriter(const PioWriter &) = delete;
+  PioWriter &operator=(const PioWriter &) = delete;
+  ~PioWriter() {
+    if (good_ && dirty_)
+      rollback();
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool good() { return good_; }
+
+  /** Appends array name_index with length values **/
+  bool appendArray(const std::string &name, const double *data,
+                   int64_t length, int index = 0) {
+    return beginArray(name, length, index) && writeData(data, length) &&
+           endArray();
+  }
+
+  /** Starts an array that is then streamed with writeData() calls
+   *  totalling length values and closed with endArray().
+   **/
+  bool beginArray(const std::string &name, int64_t length, int index = 0) {
+    if (!good_ || inArray_ || name.size() > lName_ || length < 0)
+      return false;
+    std::vector<char> entry(lEntry_, '\0');
+    memset(entry.data(), ' ', lName_);
+    memcpy(entry.data(), name.data(), name.size());
+    double v[3] = {static_cast<double>(index), static_cast<double>(length),
+                   static_cast<double>(end_)};
+    memcpy(entry.data() + lName_, v, sizeof(v));
+    newIndex_.insert(newIndex_.end(), entry.begin(), entry.end());
+    inArray_ = true;
+    dirty_ = true;
+    remaining_ = length;
+    if (verbose_) {
+      std::cout << "  Writing: " << name << "_" << index << " " << length
+                << std::endl;
+    }
+    return true;
+  }
+
+  bool writeData(const double *data, int64_t n) {
+    if (!inArray_ || n > remaining_)
+      return false;
+    if (!pwriteFull(data, n * sizeof(double), 8 * static_cast<size_t>(end_)))
+      return false;
+    end_ += n;
+    remaining_ -= n;
+    return true;
+  }
+
+  bool endArray() {
+    if (!inArray_ || remaining_ != 0)
+      return false;
+    inArray_ = false;
+    return true;
+  }
+
+  /** Writes the new index, patches the header and syncs the file **/
+  bool commit() {
+    if (!good_ || inArray_)
+      return false;
+    if (!dirty_)
+      return true;
+    const size_t indexOffset = 8 * static_cast<size_t>(end_);
+    const size_t nNew = newIndex_.size() / lEntry_;
+    bool ok = pwriteFull(oldIndex_.data(), oldIndex_.size(), indexOffset) &&
+              pwriteFull(newIndex_.data(), newIndex_.size(),
+                         indexOffset + oldIndex_.size()) &&
+              ftruncate(fd_, indexOffset + oldIndex_.size() +
+                                 newIndex_.size()) == 0 &&
+              fdatasync(fd_) == 0;
+    if (!ok)
+      return false;
+
+    // the header is only patched once data and index are on disk, and
+    // nArrays and position are adjacent so one write switches both
+    static_assert(offsetof(PIOHeader, position) ==
+                      offsetof(PIOHeader, nArrays) + sizeof(double),
+                  "nArrays and position must be adjacent");
+    double patch[2] = {header_.nArrays + nNew, static_cast<double>(end_)};
+    ok = pwriteFull(patch, sizeof(patch), offsetof(PIOHeader, nArrays)) &&
+         fdatasync(fd_) == 0;
+    if (!ok)
+      return false;
+    header_.nArrays = patch[0];
+    header_.position = patch[1];
+
+    oldIndex_.insert(oldIndex_.end(), newIndex_.begin(), newIndex_.end());
+    newIndex_.clear();
+    oldSize_ = indexOffset + oldIndex_.size();
+    end_ = (oldSize_ + 7) / 8;
+    dirty_ = false;
+    return true;
+  }
+
+  /** Drops the arrays written since the last commit by truncating the
+   *  file to its committed size.
+   **/
+  void rollback() {
+    if (ftruncate(fd_, oldSize_) == 0)
+      fdatasync(fd_);
+    newIndex_.clear();
+    end_ = (oldSize_ + 7) / 8;
+    inArray_ = false;
+    dirty_ = false;
+  }
+
+  /** Copies src to dst, sharing blocks (reflink) where the file system
+   *  allows it and copying inside the kernel otherwise.
+   **/
+  static bool clone(const std::string &src, const std::string &dst) {
+    int in = open(src.c_str(), O_RDONLY);
+    if (in < 0)
+      return false;
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+      close(in);
+      return false;
+    }
+    bool ok = ioctl(out, FICLONE, in) == 0;
+    if (!ok) {
+      struct stat st;
+      ok = fstat(in, &st) == 0;
+      off_t left = ok ? st.st_size : 0;
+      while (ok && left > 0) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, left, 0);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        left -= n;
+      }
+      // fall back to plain reads and writes, e.g. across file systems
+      if (ok && left > 0) {
+        off_t pos = st.st_size - left;
+        std::vector<char> buf(1 << 24);
+        while (ok && left > 0) {
+          size_t n = PIO::preadFull(in, pos, std::min<off_t>(left, buf.size()),
+                                    buf.data());
+          ok = n > 0 && pwrite(out, buf.data(), n, pos) == (ssize_t)n;
+          pos += n;
+          left -= n;
+        }
+      }
+    }
+    ok = (close(out) == 0) && ok;
+    close(in);
+    return ok;
+  }
+
+private:
+  int fd_;
+  bool verbose_;
+  bool good_;
+  bool inArray_;  //< between beginArray() and endArray()
+  bool dirty_;    //< arrays written since the last commit
+  PIOHeader header_;
+  size_t lName_ = 0;
+  size_t lEntry_ = 0;             //< bytes per index entry
+  std::vector<char> oldIndex_;    //< committed index block
+  std::vector<char> newIndex_;    //< entries of uncommitted arrays
+  off_t oldSize_ = 0;             //< committed file size [bytes]
+  int64_t end_ = 0;               //< end of array data [doubles]
+  int64_t remaining_ = 0;         //< values still due for current array
+
+  bool pwriteFull(const void *data, size_t n, size_t offset) {
+    const char *p = static_cast<const char *>(data);
+    size_t done = 0;
+    while (done < n) {
+      ssize_t w = pwrite(fd_, p + done, n - done, offset + done);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return false;
+      done += w;
+    }
+    return true;
+  }
+};
+
+#endif
+
+// END
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+"""
+========================================================================================
+ (C) (or copyright) 2022. Triad National Security, LLC. All rights reserved.
+
+ This program was produced under U.S. Government contract 89233218CNA000001 for Los
+ Alamos National Laboratory (LANL), which is operated by Triad National Security, LLC
+ for the U.S. Department of Energy/National Nuclear Security Administration. All rights
+ in the program are reserved by Triad National Security, LLC, and the U.S. Department
+ of Energy/National Nuclear Security Administration. The Government is granted for
+ itself and others acting on its behalf a nonexclusive, paid-up, irrevocable worldwide
+ license in this material to reproduce, prepare derivative works, distribute copies to
+ the public, perform publicly and display publicly, and to permit others to do so.
+========================================================================================
+
+Drop-in replacement for the pio class of pio.py that reads arrays
+and expands CSR variables through the C++ classes PIO and
+PioInterface.  Scripts only need to change their import:
+
+  from piocpp import pio
+
+Arrays are read by C++ straight into NumPy arrays.  With mmap=True
+readArray() returns read-only arrays backed by the mapped file, with
+no copy at all.  readArrayInt() returns an int64 NumPy array rather
+than a list.
+
+Requires libpiocpp.so next to this script or named by the PIOCPP_LIB
+environment variable.  Build it with
+
+  g++ -std=c++17 -O3 -fPIC -shared -pthread pioCApi.cpp pioInterface.cpp -o libpiocpp.so
+"""
+from __future__ import print_function
+import ctypes
+import os
+
+import numpy as np
+
+import pio as _pio
+
+_lib = None
+
+
+def library():
+    """ Loads libpiocpp.so on first use """
+    global _lib
+    if _lib is not None:
+        return _lib
+    name = os.environ.get("PIOCPP_LIB")
+    if name is None:
+        name = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libpiocpp.so")
+    lib = ctypes.CDLL(name)
+
+    doubles = np.ctypeslib.ndpointer(np.float64, flags="C_CONTIGUOUS")
+    int64s = np.ctypeslib.ndpointer(np.int64, flags="C_CONTIGUOUS")
+    c_int64 = ctypes.c_int64
+    lib.pio_open.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+    lib.pio_open.restype = ctypes.c_void_p
+    lib.pio_close.argtypes = [ctypes.c_void_p]
+    lib.pio_close.restype = None
+    lib.pio_mapped.argtypes = [ctypes.c_void_p]
+    lib.pio_mapped.restype = ctypes.c_int
+    lib.pio_array_length.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.pio_array_length.restype = c_int64
+    lib.pio_read_array.argtypes = [ctypes.c_void_p, ctypes.c_char_p, doubles]
+    lib.pio_read_array.restype = c_int64
+    lib.pio_read_array_int.argtypes = [ctypes.c_void_p, ctypes.c_char_p, int64s]
+    lib.pio_read_array_int.restype = c_int64
+    lib.pio_read_array_range.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        c_int64,
+        c_int64,
+        doubles,
+    ]
+    lib.pio_read_array_range.restype = c_int64
+    lib.pio_array_view.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        ctypes.POINTER(c_int64),
+    ]
+    lib.pio_array_view.restype = ctypes.c_void_p
+    lib.pio_interface_open.argtypes = [ctypes.c_char_p, ctypes.c_int]
+    lib.pio_interface_open.restype = ctypes.c_void_p
+    lib.pio_interface_close.argtypes = [ctypes.c_void_p]
+    lib.pio_interface_close.restype = None
+    lib.pio_interface_nmat.argtypes = [ctypes.c_void_p]
+    lib.pio_interface_nmat.restype = ctypes.c_int
+    lib.pio_expand_material.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        ctypes.c_int,
+        ctypes.c_int,
+        doubles,
+    ]
+    lib.pio_expand_material.restype = ctypes.c_int
+    _lib = lib
+    return lib
+
+
+class pio(_pio.pio):
+    """
+    pio class of pio.py with array reads and CSR expansion done in C++.
+    The index is still parsed by pio.py so that the write functions
+    keep working unchanged.
+    """
+
+    def __init__(self, theFile, verbose=0, mmap=False, nThreads=0):
+        """
+        Opens theFile.  With mmap set the file is mapped and arrays
+        are returned as read-only views into it.  nThreads is used for
+        CSR expansion (0 uses all hardware threads).
+        """
+        self._handle = None
+        self._interface = None
+        super().__init__(theFile, verbose)
+        self.fileName = theFile
+        self.nThreads = nThreads
+        self._lib = library()
+        self._handle = self._lib.pio_open(os.fsencode(theFile), int(mmap), int(verbose))
+        if not self._handle:
+            raise ValueError("Unable to open " + theFile)
+        self.mmap = self._lib.pio_mapped(self._handle) == 1
+
+    def __del__(self):
+        if self._interface:
+            self._lib.pio_interface_close(self._interface)
+            self._interface = None
+        if self._handle:
+            self._lib.pio_close(self._handle)
+            self._handle = None
+
+    def interface(self):
+        """ Returns the PioInterface handle, opening it on first use """
+        if self._interface is None:
+            self._interface = self._lib.pio_interface_open(
+                os.fsencode(self.fileName), int(self.nThreads)
+            )
+        return self._interface
+
+    def arrayLength(self, name):
+        """ Length of array name in the file, -1 if it is not there """
+        return self._lib.pio_array_length(self._handle, name.encode())
+
+    def readArray(self, name):
+        """
+        Reads given array from the file and
+        returns it as an array of doubles.
+
+        Returns None if array is not found or cannot be read in full.
+        """
+        n = self.arrayLength(name)
+        if n < 0:
+            return None
+        if self.mmap:
+            length = ctypes.c_int64(0)
+            ptr = self._lib.pio_array_view(self._handle, name.encode(), ctypes.byref(length))
+            if n == 0:
+                return np.zeros(0)
+            if not ptr or length.value != n:
+                return None
+            buf = (ctypes.c_double * length.value).from_address(ptr)
+            buf._owner = self  # the mapping lives as long as self
+            data = np.frombuffer(buf, dtype=np.float64)
+            data.flags.writeable = False
+            return data
+        data = np.empty(n, dtype=np.float64)
+        if self._lib.pio_read_array(self._handle, name.encode(), data) != n:
+            return None
+        return data
+
+    def readArrayInt(self, name):
+        """
+        Reads given array from the file and
+        returns it as an array of int64.
+
+        Returns None if array is not found or cannot be read in full.
+        """
+        n = self.arrayLength(name)
+        if n < 0:
+            return None
+        data = np.empty(n, dtype=np.int64)
+        if self._lib.pio_read_array_int(self._handle, name.encode(), data) != n:
+            return None
+        return data
+
+    def readArrayRange(self, name, iStart, N, force=False, ints=False):
+        """
+        Reads N entries from given array starting at iStart
+        Returns it as an array of doubles (int64 if ints is set).
+
+        Returns None if array is not found.
+        """
+        if self.arrayLength(name) < 0:
+            return None
+        data = np.empty(int(N), dtype=np.float64)
+        n = self._lib.pio_read_array_range(
+            self._handle, name.encode(), int(iStart), int(N), data
+        )
+        data = data[: max(n, 0)]
+        if ints:
+            return data.astype(np.int64)
+        return data
+
+    def updateCsrIndices(self, csr_counts, csr_ids, csr_vols, shift=1):
+        if self.csrIdx is not None:
+            return
+
+        if not csr_counts.endswith("_0"):
+            csr_counts += "_0"
+
+        if not csr_ids.endswith("_0"):
+            csr_ids += "_0"
+
+        if not csr_vols.endswith("_0"):
+            csr_vols += "_0"
+
+        # cells with no volume get 0 rather than inf, as in the C++ reader
+        vols = self.readArray(csr_vols)
+        self.invVolume = np.divide(
+            1.0, vols, out=np.zeros_like(vols), where=vols != 0
+        )
+
+        self.csrID = self.readArrayInt(csr_ids)
+        self.csrN = int(self.csrID.max()) if len(self.csrID) else 0
+        self.csrID -= shift
+
+        counts = self.readArrayInt(csr_counts)
+        self.csrLen = int(counts.sum())
+        self.csrIdx = np.zeros(self.numcell + 1, dtype=np.int64)
+        np.cumsum(counts, out=self.csrIdx[1:])
+
+    def expandCsrVariable(self, name, scale=False):
+        """
+        Returns the expanded "index" version of the variable
+        """
+        if self.csrN == 0:
+            return None
+
+        if name.endswith("_0"):
+            name = name[:-2]
+        newArray = np.zeros((self.csrN, self.numcell))
+        handle = self.interface()
+        if not handle or self._lib.pio_expand_material(
+            handle, name.encode(), int(scale), self.csrN, newArray
+        ):
+            return None
+        return newArray
+
+
+if __name__ == "__main__":
+    import sys
+
+    if len(sys.argv) < 2:
+        print(
+            f"""
+        {sys.argv[0]} takes one argument, a PIO file.
+        """
+        )
+    else:
+        p = pio(sys.argv[1], mmap=True)
+        p.updateCsrIndices("chunk_nummat", "chunk_mat", "vcell", 1)
+        print(f"numcell={p.numcell} ndim={p.ndim} nummat={p.csrN}")
+        for name in ["chunk_vol", "chunk_eng"]:
+            x = p.expandCsrVariable(name, True)
+            if x is not None:
+                print(name, x.shape, x.sum(axis=1))